@@ -27,9 +27,15 @@ struct cache_slot {
 	size_t keylen;
 	int ttl;
 	cache_fill_fn fn;
+	cache_fragment_fn fragment_fn;
+	void *data;
+	int discard;
+	int wait;
+	int stored;
 	int cache_fd;
 	int lock_fd;
 	int stdout_fd;
+	struct cache_slot *outer;
 	const char *cache_name;
 	const char *lock_name;
 	int match;
@@ -38,6 +44,11 @@ struct cache_slot {
 	char buf[CACHE_BUFSIZE];
 };
 
+/* The slots being filled, innermost first. Their saved stdout leads to
+ * the client, see cache_detach().
+ */
+static struct cache_slot *filling;
+
 /* Open an existing cache slot and fill the cache buffer with
  * (part of) the content of the cache file. Return 0 on success
  * and errno otherwise.
@@ -174,17 +185,39 @@ static int lock_slot(struct cache_slot *slot)
 		.l_start = 0,
 		.l_len = 0,
 	};
+	struct stat fd_st, path_st;
 
-	slot->lock_fd = open(slot->lock_name, O_RDWR | O_CREAT,
-			     S_IRUSR | S_IWUSR);
-	if (slot->lock_fd == -1)
-		return errno;
-	if (fcntl(slot->lock_fd, F_SETLK, &lock) < 0) {
-		int saved_errno = errno;
+	for (;;) {
+		slot->lock_fd = open(slot->lock_name, O_RDWR | O_CREAT,
+				     S_IRUSR | S_IWUSR);
+		if (slot->lock_fd == -1)
+			return errno;
+		if (fcntl(slot->lock_fd, F_SETLK, &lock) < 0) {
+			int saved_errno = errno;
+			close(slot->lock_fd);
+			slot->lock_fd = -1;
+			return saved_errno;
+		}
+		/* The lockfile may have been renamed to the cache slot or
+		 * removed between our open() and fcntl(); then we hold a
+		 * lock on a file which is no longer the lockfile.
+		 */
+		if (fstat(slot->lock_fd, &fd_st)) {
+			int saved_errno = errno;
+			close(slot->lock_fd);
+			slot->lock_fd = -1;
+			return saved_errno;
+		}
+		if (!stat(slot->lock_name, &path_st) &&
+		    fd_st.st_dev == path_st.st_dev &&
+		    fd_st.st_ino == path_st.st_ino)
+			break;
 		close(slot->lock_fd);
 		slot->lock_fd = -1;
-		return saved_errno;
 	}
+	/* Discard anything left behind by an interrupted writer. */
+	if (ftruncate(slot->lock_fd, 0))
+		return errno;
 	if (xwrite(slot->lock_fd, slot->key, slot->keylen + 1) < 0)
 		return errno;
 	return 0;
@@ -202,12 +235,23 @@ static int unlock_slot(struct cache_slot *slot, int replace_old_slot)
 		err = rename(slot->lock_name, slot->cache_name);
 	else
 		err = unlink(slot->lock_name);
+	if (!err && replace_old_slot) {
+		struct flock lock = {
+			.l_type = F_UNLCK,
+			.l_whence = SEEK_SET,
+		};
+
+		/* Let waiters read the new slot while it is printed. */
+		fcntl(slot->lock_fd, F_SETLK, &lock);
+		slot->stored = 1;
+	}
 
 	/* Restore stdout and close the temporary FD. */
 	if (slot->stdout_fd >= 0) {
 		dup2(slot->stdout_fd, STDOUT_FILENO);
 		close(slot->stdout_fd);
 		slot->stdout_fd = -1;
+		filling = slot->outer;
 	}
 
 	if (err)
@@ -216,6 +260,37 @@ static int unlock_slot(struct cache_slot *slot, int replace_old_slot)
 	return 0;
 }
 
+/* Wait until a concurrent writer of the slot has released its lock.
+ * Returns 0 if it is done, and errno otherwise.
+ */
+static int wait_slot(struct cache_slot *slot)
+{
+	struct flock lock = {
+		.l_type = F_RDLCK,
+		.l_whence = SEEK_SET,
+		.l_start = 0,
+		.l_len = 0,
+	};
+	int fd, err = 0;
+
+	fd = open(slot->lock_name, O_RDONLY);
+	if (fd == -1)
+		return errno == ENOENT ? 0 : errno;
+	if (fcntl(fd, F_SETLKW, &lock) < 0)
+		err = errno;
+	close(fd);
+	return err;
+}
+
+/* Invoke the content generator of the slot */
+static void generate_slot(struct cache_slot *slot)
+{
+	if (slot->fn)
+		slot->fn();
+	else
+		slot->discard = slot->fragment_fn(slot->data);
+}
+
 /* Generate the content for the current cache slot by redirecting
  * stdout to the lock-fd and invoking the callback function
  */
@@ -225,13 +300,17 @@ static int fill_slot(struct cache_slot *slot)
 	slot->stdout_fd = dup(STDOUT_FILENO);
 	if (slot->stdout_fd == -1)
 		return errno;
+	/* Programs started meanwhile must not hold the response open. */
+	fcntl(slot->stdout_fd, F_SETFD, FD_CLOEXEC);
+	slot->outer = filling;
+	filling = slot;
 
 	/* Redirect stdout to lockfile */
 	if (dup2(slot->lock_fd, STDOUT_FILENO) == -1)
 		return errno;
 
 	/* Generate cache content */
-	slot->fn();
+	generate_slot(slot);
 
 	/* Make sure any buffered data is flushed to the file */
 	if (fflush(stdout))
@@ -266,6 +345,22 @@ unsigned long hash_str(const char *str)
 	return h;
 }
 
+/* Append the name of the cache slot used for `key` to `filename`. */
+static void slot_filename(struct strbuf *filename, int size, const char *path,
+			  const char *key)
+{
+	unsigned long hash;
+	int i;
+
+	hash = hash_str(key) % size;
+	strbuf_addstr(filename, path);
+	strbuf_ensure_end(filename, '/');
+	for (i = 0; i < 8; i++) {
+		strbuf_addf(filename, "%x", (unsigned char)(hash & 0xf));
+		hash >>= 4;
+	}
+}
+
 static int process_slot(struct cache_slot *slot)
 {
 	int err;
@@ -295,7 +390,7 @@ static int process_slot(struct cache_slot *slot)
 					close_lock(slot);
 				} else {
 					close_slot(slot);
-					unlock_slot(slot, 1);
+					unlock_slot(slot, !slot->discard);
 					slot->cache_fd = slot->lock_fd;
 				}
 			}
@@ -319,9 +414,14 @@ static int process_slot(struct cache_slot *slot)
 
 	close_slot(slot);
 	if ((err = lock_slot(slot)) != 0) {
+		/* Use the content of a concurrent writer once it is done. */
+		if (slot->wait && !wait_slot(slot)) {
+			slot->wait = 0;
+			return process_slot(slot);
+		}
 		cache_log("[cgit] Unable to lock slot %s: %s (%d)\n",
 			  slot->lock_name, strerror(err), err);
-		slot->fn();
+		generate_slot(slot);
 		return 0;
 	}
 
@@ -330,7 +430,7 @@ static int process_slot(struct cache_slot *slot)
 			  slot->lock_name, strerror(err), err);
 		unlock_slot(slot, 0);
 		close_lock(slot);
-		slot->fn();
+		generate_slot(slot);
 		return 0;
 	}
 	// We've got a valid cache slot in the lock file, which
@@ -341,7 +441,7 @@ static int process_slot(struct cache_slot *slot)
 	// Lets avoid such a race by just printing the content of
 	// the lock file.
 	slot->cache_fd = slot->lock_fd;
-	unlock_slot(slot, 1);
+	unlock_slot(slot, !slot->discard);
 	if ((err = print_slot(slot)) != 0) {
 		cache_log("[cgit] error printing cache %s: %s (%d)\n",
 			  slot->cache_name,
@@ -356,8 +456,6 @@ static int process_slot(struct cache_slot *slot)
 int cache_process(int size, const char *path, const char *key, int ttl,
 		  cache_fill_fn fn)
 {
-	unsigned long hash;
-	int i;
 	struct strbuf filename = STRBUF_INIT;
 	struct strbuf lockname = STRBUF_INIT;
 	struct cache_slot slot;
@@ -377,16 +475,14 @@ int cache_process(int size, const char *path, const char *key, int ttl,
 	}
 	if (!key)
 		key = "";
-	hash = hash_str(key) % size;
-	strbuf_addstr(&filename, path);
-	strbuf_ensure_end(&filename, '/');
-	for (i = 0; i < 8; i++) {
-		strbuf_addf(&filename, "%x", (unsigned char)(hash & 0xf));
-		hash >>= 4;
-	}
+	slot_filename(&filename, size, path, key);
 	strbuf_addbuf(&lockname, &filename);
 	strbuf_addstr(&lockname, ".lock");
 	slot.fn = fn;
+	slot.fragment_fn = NULL;
+	slot.discard = 0;
+	slot.wait = 0;
+	slot.stored = 0;
 	slot.ttl = ttl;
 	slot.stdout_fd = -1;
 	slot.cache_name = filename.buf;
@@ -400,6 +496,269 @@ int cache_process(int size, const char *path, const char *key, int ttl,
 	return result;
 }
 
+/* Process the slot stored in `filename` with a fragment generator. */
+static int process_fragment_slot(const char *filename, const char *key,
+				 int ttl, int wait, cache_fragment_fn fn,
+				 void *data, int *stored)
+{
+	struct strbuf lockname = STRBUF_INIT;
+	struct cache_slot slot = { NULL };
+	int result;
+
+	strbuf_addf(&lockname, "%s.lock", filename);
+	slot.fragment_fn = fn;
+	slot.data = data;
+	slot.ttl = ttl;
+	slot.wait = wait;
+	slot.stdout_fd = -1;
+	slot.cache_name = filename;
+	slot.lock_name = lockname.buf;
+	slot.key = key;
+	slot.keylen = strlen(key);
+	result = process_slot(&slot);
+	if (stored)
+		*stored = slot.stored;
+
+	strbuf_release(&lockname);
+	return result;
+}
+
+/* Print a cached part of a page to stdout, generate it if necessary. */
+int cache_fragment(int size, const char *path, const char *key, int ttl,
+		   cache_fragment_fn fn, void *data)
+{
+	struct strbuf filename = STRBUF_INIT;
+	int result;
+
+	if (size <= 0 || ttl == 0 || !path ||
+	    (mkdir(path, 0755) && errno != EEXIST)) {
+		fn(data);
+		return 0;
+	}
+
+	slot_filename(&filename, size, path, key);
+	result = process_fragment_slot(filename.buf, key, ttl, 0, fn, data,
+				       NULL);
+	strbuf_release(&filename);
+	return result;
+}
+
+/* Print the content stored for `key` in the file `name`, generate it if
+ * necessary.
+ */
+int cache_file(const char *path, const char *name, const char *key,
+	       off_t max_size, cache_fragment_fn fn, void *data)
+{
+	struct strbuf filename = STRBUF_INIT;
+	int result, stored;
+
+	if (!path || (mkdir(path, 0755) && errno != EEXIST)) {
+		fn(data);
+		return 0;
+	}
+
+	strbuf_addstr(&filename, path);
+	strbuf_ensure_end(&filename, '/');
+	strbuf_addstr(&filename, name);
+	result = process_fragment_slot(filename.buf, key, -1, 1, fn, data,
+				       &stored);
+	/* Mark the file as recently used for cache_trim(). */
+	utime(filename.buf, NULL);
+	if (stored)
+		cache_trim(path, max_size);
+	strbuf_release(&filename);
+	return result;
+}
+
+int cache_file_open(const char *path, const char *name, const char *key,
+		    off_t max_size, cache_fragment_fn fn, void *data)
+{
+	struct strbuf filename = STRBUF_INIT;
+	struct strbuf lockname = STRBUF_INIT;
+	struct cache_slot slot = { NULL };
+	off_t off;
+	int wait, fd = -1;
+
+	if (!path || (mkdir(path, 0755) && errno != EEXIST))
+		return -1;
+
+	strbuf_addstr(&filename, path);
+	strbuf_ensure_end(&filename, '/');
+	strbuf_addstr(&filename, name);
+	strbuf_addf(&lockname, "%s.lock", filename.buf);
+	slot.fragment_fn = fn;
+	slot.data = data;
+	slot.ttl = -1;
+	slot.stdout_fd = -1;
+	slot.cache_name = filename.buf;
+	slot.lock_name = lockname.buf;
+	slot.key = key;
+	slot.keylen = strlen(key);
+	off = slot.keylen + 1;
+
+	for (wait = 1; ; wait = 0) {
+		if (!open_slot(&slot) && slot.match) {
+			fd = slot.cache_fd;
+			utime(filename.buf, NULL);
+			goto out;
+		}
+		close_slot(&slot);
+		if (!lock_slot(&slot))
+			break;
+		/* Use the content of a concurrent writer once it is done. */
+		if (!wait || wait_slot(&slot))
+			goto out;
+	}
+	if (fill_slot(&slot) || slot.discard) {
+		unlock_slot(&slot, 0);
+		close_lock(&slot);
+		goto out;
+	}
+	unlock_slot(&slot, 1);
+	fd = slot.lock_fd;
+	cache_trim(path, max_size);
+
+out:
+	if (fd >= 0 && lseek(fd, off, SEEK_SET) != off) {
+		close(fd);
+		fd = -1;
+	}
+	strbuf_release(&filename);
+	strbuf_release(&lockname);
+	return fd;
+}
+
+struct cache_entry_info {
+	char *name;
+	off_t size;
+	time_t mtime;
+};
+
+static int cmp_entry_mtime(const void *a, const void *b)
+{
+	const struct cache_entry_info *ea = a, *eb = b;
+
+	if (ea->mtime != eb->mtime)
+		return ea->mtime < eb->mtime ? -1 : 1;
+	return strcmp(ea->name, eb->name);
+}
+
+int cache_trim(const char *path, off_t max_size)
+{
+	DIR *dir;
+	struct dirent *ent;
+	struct stat st;
+	struct strbuf fullname = STRBUF_INIT;
+	struct cache_entry_info *entries = NULL;
+	size_t nr = 0, alloc = 0, prefixlen, i;
+	off_t total = 0;
+
+	dir = opendir(path);
+	if (!dir)
+		return errno;
+	strbuf_addstr(&fullname, path);
+	strbuf_ensure_end(&fullname, '/');
+	prefixlen = fullname.len;
+	while ((ent = readdir(dir)) != NULL) {
+		if (ent->d_name[0] == '.' || ends_with(ent->d_name, ".lock"))
+			continue;
+		strbuf_setlen(&fullname, prefixlen);
+		strbuf_addstr(&fullname, ent->d_name);
+		if (stat(fullname.buf, &st) || !S_ISREG(st.st_mode))
+			continue;
+		ALLOC_GROW(entries, nr + 1, alloc);
+		entries[nr].name = xstrdup(fullname.buf);
+		entries[nr].size = st.st_size;
+		entries[nr].mtime = st.st_mtime;
+		total += st.st_size;
+		nr++;
+	}
+	closedir(dir);
+
+	QSORT(entries, nr, cmp_entry_mtime);
+	for (i = 0; i < nr; i++) {
+		if (total > max_size && !unlink(entries[i].name))
+			total -= entries[i].size;
+		free(entries[i].name);
+	}
+	free(entries);
+	strbuf_release(&fullname);
+	return 0;
+}
+
+/* Read the data stored for `key` into `buf`. */
+int cache_get(int size, const char *path, const char *key, int ttl,
+	      struct strbuf *buf)
+{
+	struct strbuf filename = STRBUF_INIT;
+	struct cache_slot slot = { NULL };
+	int err;
+
+	if (size <= 0 || !path)
+		return ENOENT;
+
+	slot_filename(&filename, size, path, key);
+	slot.cache_name = filename.buf;
+	slot.key = key;
+	slot.keylen = strlen(key);
+	slot.ttl = ttl;
+	err = open_slot(&slot);
+	if (!err && (!slot.match || is_expired(&slot)))
+		err = ENOENT;
+	if (!err) {
+		off_t off = slot.keylen + 1;
+
+		strbuf_reset(buf);
+		if (lseek(slot.cache_fd, off, SEEK_SET) != off ||
+		    strbuf_read(buf, slot.cache_fd, slot.cache_st.st_size - off) < 0)
+			err = errno;
+	}
+	close_slot(&slot);
+	strbuf_release(&filename);
+	return err;
+}
+
+/* Store `len` bytes of `data` as the content for `key`. */
+int cache_put(int size, const char *path, const char *key,
+	      const void *data, size_t len)
+{
+	struct strbuf filename = STRBUF_INIT;
+	struct strbuf lockname = STRBUF_INIT;
+	struct cache_slot slot = { NULL };
+	int err;
+
+	if (size <= 0 || !path)
+		return 0;
+
+	if (mkdir(path, 0755) && errno != EEXIST)
+		return errno;
+
+	slot_filename(&filename, size, path, key);
+	strbuf_addbuf(&lockname, &filename);
+	strbuf_addstr(&lockname, ".lock");
+	slot.cache_name = filename.buf;
+	slot.lock_name = lockname.buf;
+	slot.key = key;
+	slot.keylen = strlen(key);
+	slot.stdout_fd = -1;
+
+	/* Somebody else is already storing this slot, let them have it. */
+	err = lock_slot(&slot);
+	if (err)
+		goto out;
+	if (write_in_full(slot.lock_fd, data, len) < 0) {
+		err = errno;
+		unlock_slot(&slot, 0);
+	} else {
+		err = unlock_slot(&slot, 1);
+	}
+	close_lock(&slot);
+out:
+	strbuf_release(&filename);
+	strbuf_release(&lockname);
+	return err;
+}
+
 /* Return a strftime formatted date/time
  * NB: the result from this function is to shared memory
  */
@@ -462,6 +821,31 @@ int cache_ls(const char *path)
 	return 0;
 }
 
+/* Release the response, including the stdout of the slots being filled,
+ * in a child process which may outlive it. Otherwise the web server would
+ * wait for the child before completing the response.
+ */
+void cache_detach(void)
+{
+	struct cache_slot *slot;
+	int fd;
+
+	for (slot = filling; slot; slot = slot->outer) {
+		close(slot->stdout_fd);
+		slot->stdout_fd = -1;
+	}
+	filling = NULL;
+
+	fd = open("/dev/null", O_RDWR);
+	if (fd < 0)
+		return;
+	dup2(fd, STDIN_FILENO);
+	dup2(fd, STDOUT_FILENO);
+	dup2(fd, STDERR_FILENO);
+	if (fd > STDERR_FILENO)
+		close(fd);
+}
+
 /* Print a message to stdout */
 void cache_log(const char *format, ...)
 {
@@ -7,6 +7,7 @@
 #define CGIT_CACHE_H
 
 typedef void (*cache_fill_fn)(void);
+typedef int (*cache_fragment_fn)(void *data);
 
 
 /* Print cached content to stdout, generate the content if necessary.
@@ -25,6 +26,65 @@ extern int cache_process(int size, const char *path, const char *key, int ttl,
 			 cache_fill_fn fn);
 
 
+/* Like cache_process(), but for a part of a page which is generated by
+ * calling `fn` with `data`. The directory `path` is created if needed.
+ * If `fn` returns non-zero its output is printed but not stored.
+ */
+extern int cache_fragment(int size, const char *path, const char *key,
+			  int ttl, cache_fragment_fn fn, void *data);
+
+
+/* Like cache_fragment(), but the content is stored in the file `name` in
+ * the directory `path`, and kept until cache_trim() removes it. After
+ * storing new content, `path` is trimmed to `max_size` bytes. While
+ * another process generates the same file, wait for it and print its
+ * content instead.
+ */
+extern int cache_file(const char *path, const char *name, const char *key,
+		      off_t max_size, cache_fragment_fn fn, void *data);
+
+/* Like cache_file(), but instead of printing the content, return a file
+ * descriptor positioned at its start, or -1 if it is not available.
+ */
+extern int cache_file_open(const char *path, const char *name,
+			   const char *key, off_t max_size,
+			   cache_fragment_fn fn, void *data);
+
+/* Remove the least recently used files in `path` until the remaining
+ * ones take up at most `max_size` bytes. Returns 0 on success and errno
+ * otherwise.
+ */
+extern int cache_trim(const char *path, off_t max_size);
+
+
+/* Read the data stored for a key by cache_put().
+ *
+ * Parameters
+ *   size    max number of cache files in `path`
+ *   path    directory used to store the data
+ *   key     the key used to lookup the data
+ *   ttl     max age in minutes for the stored data (negative: no limit)
+ *   buf     buffer which receives the data
+ *
+ * Return value
+ *   0 on success, ENOENT if nothing (or only expired data) is stored for
+ *   the key, errno otherwise
+ */
+extern int cache_get(int size, const char *path, const char *key, int ttl,
+		     struct strbuf *buf);
+
+/* Store `len` bytes of `data` for `key` in the directory `path`, which is
+ * created if needed. Returns 0 on success and errno otherwise.
+ */
+extern int cache_put(int size, const char *path, const char *key,
+		     const void *data, size_t len);
+
+/* Point stdin, stdout and stderr to /dev/null and close the client's
+ * stdout saved by the slots being filled, in a child process which may
+ * outlive the response.
+ */
+extern void cache_detach(void);
+
 /* List info about all cache entries on stdout */
 extern int cache_ls(const char *path);
 
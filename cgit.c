@@ -17,7 +17,10 @@
 #include "ui-stats.h"
 #include "ui-blob.h"
 #include "ui-summary.h"
+#include "ui-snapshot.h"
+#include "repolist-index.h"
 #include "scan-tree.h"
+#include "run-command.h"
 
 const char *cgit_version = CGIT_VERSION;
 
@@ -64,6 +67,8 @@ static void repo_config(struct cgit_repo *repo, const char *name, const char *va
 		repo->snapshots = ctx.cfg.snapshots & cgit_parse_snapshots_mask(value);
 	else if (!strcmp(name, "enable-blame"))
 		repo->enable_blame = atoi(value);
+	else if (!strcmp(name, "enable-bloom-filters"))
+		repo->enable_bloom_filters = atoi(value);
 	else if (!strcmp(name, "enable-commit-graph"))
 		repo->enable_commit_graph = atoi(value);
 	else if (!strcmp(name, "enable-follow-links"))
@@ -78,6 +83,10 @@ static void repo_config(struct cgit_repo *repo, const char *name, const char *va
 		repo->enable_subject_links = atoi(value);
 	else if (!strcmp(name, "enable-html-serving"))
 		repo->enable_html_serving = atoi(value);
+	else if (!strcmp(name, "enable-tree-sizes"))
+		repo->enable_tree_sizes = atoi(value);
+	else if (!strcmp(name, "enable-tree-last-commit"))
+		repo->enable_tree_last_commit = atoi(value);
 	else if (!strcmp(name, "branch-sort")) {
 		if (!strcmp(value, "age"))
 			repo->branch_sort = 1;
@@ -173,18 +182,28 @@ static void config_cb(const char *name, const char *value)
 		ctx.cfg.noheader = atoi(value);
 	else if (!strcmp(name, "snapshots"))
 		ctx.cfg.snapshots = cgit_parse_snapshots_mask(value);
+	else if (!strcmp(name, "enable-snapshot-staging"))
+		ctx.cfg.enable_snapshot_staging = atoi(value);
+	else if (!strcmp(name, "snapshot-cache-size"))
+		ctx.cfg.snapshot_cache_size = atoi(value);
+	else if (!strcmp(name, "snapshot-threads"))
+		ctx.cfg.snapshot_threads = atoi(value);
 	else if (!strcmp(name, "enable-filter-overrides"))
 		ctx.cfg.enable_filter_overrides = atoi(value);
 	else if (!strcmp(name, "enable-follow-links"))
 		ctx.cfg.enable_follow_links = atoi(value);
 	else if (!strcmp(name, "enable-http-clone"))
 		ctx.cfg.enable_http_clone = atoi(value);
+	else if (!strcmp(name, "enable-smart-http"))
+		ctx.cfg.enable_smart_http = atoi(value);
 	else if (!strcmp(name, "enable-index-links"))
 		ctx.cfg.enable_index_links = atoi(value);
 	else if (!strcmp(name, "enable-index-owner"))
 		ctx.cfg.enable_index_owner = atoi(value);
 	else if (!strcmp(name, "enable-blame"))
 		ctx.cfg.enable_blame = atoi(value);
+	else if (!strcmp(name, "enable-bloom-filters"))
+		ctx.cfg.enable_bloom_filters = atoi(value);
 	else if (!strcmp(name, "enable-commit-graph"))
 		ctx.cfg.enable_commit_graph = atoi(value);
 	else if (!strcmp(name, "enable-log-filecount"))
@@ -197,10 +216,22 @@ static void config_cb(const char *name, const char *value)
 		ctx.cfg.enable_subject_links = atoi(value);
 	else if (!strcmp(name, "enable-html-serving"))
 		ctx.cfg.enable_html_serving = atoi(value);
+	else if (!strcmp(name, "enable-tree-sizes"))
+		ctx.cfg.enable_tree_sizes = atoi(value);
+	else if (!strcmp(name, "enable-tree-last-commit"))
+		ctx.cfg.enable_tree_last_commit = atoi(value);
 	else if (!strcmp(name, "enable-tree-linenumbers"))
 		ctx.cfg.enable_tree_linenumbers = atoi(value);
 	else if (!strcmp(name, "enable-git-config"))
 		ctx.cfg.enable_git_config = atoi(value);
+	else if (!strcmp(name, "enable-blame-cache"))
+		ctx.cfg.enable_blame_cache = atoi(value);
+	else if (!strcmp(name, "enable-fragment-cache"))
+		ctx.cfg.enable_fragment_cache = atoi(value);
+	else if (!strcmp(name, "enable-rename-cache"))
+		ctx.cfg.enable_rename_cache = atoi(value);
+	else if (!strcmp(name, "enable-stats-cache"))
+		ctx.cfg.enable_stats_cache = atoi(value);
 	else if (!strcmp(name, "max-stats"))
 		ctx.cfg.max_stats = cgit_find_stats_period(value, NULL);
 	else if (!strcmp(name, "cache-size"))
@@ -247,6 +278,10 @@ static void config_cb(const char *name, const char *value)
 		ctx.cfg.max_repo_count = atoi(value);
 		if (ctx.cfg.max_repo_count <= 0)
 			ctx.cfg.max_repo_count = INT_MAX;
+	} else if (!strcmp(name, "max-ref-count")) {
+		ctx.cfg.max_ref_count = atoi(value);
+		if (ctx.cfg.max_ref_count <= 0)
+			ctx.cfg.max_ref_count = INT_MAX;
 	} else if (!strcmp(name, "max-commit-count"))
 		ctx.cfg.max_commit_count = atoi(value);
 	else if (!strcmp(name, "project-list"))
@@ -283,6 +318,10 @@ static void config_cb(const char *name, const char *value)
 		ctx.cfg.mimetype_file = xstrdup(value);
 	else if (!strcmp(name, "renamelimit"))
 		ctx.cfg.renamelimit = atoi(value);
+	else if (!strcmp(name, "rename-budget"))
+		ctx.cfg.rename_budget = atoi(value);
+	else if (!strcmp(name, "blame-budget"))
+		ctx.cfg.blame_budget = atoi(value);
 	else if (!strcmp(name, "remove-suffix"))
 		ctx.cfg.remove_suffix = atoi(value);
 	else if (!strcmp(name, "robots"))
@@ -345,6 +384,8 @@ static void querystring_cb(const char *name, const char *value)
 		ctx.qry.name = xstrdup(value);
 	} else if (!strcmp(name, "s")) {
 		ctx.qry.sort = xstrdup(value);
+	} else if (!strcmp(name, "service")) {
+		ctx.qry.service = xstrdup(value);
 	} else if (!strcmp(name, "showmsg")) {
 		ctx.qry.showmsg = atoi(value);
 	} else if (!strcmp(name, "period")) {
@@ -390,8 +431,10 @@ static void prepare_context(void)
 	ctx.cfg.enable_http_clone = 1;
 	ctx.cfg.enable_index_owner = 1;
 	ctx.cfg.enable_tree_linenumbers = 1;
+	ctx.cfg.enable_tree_sizes = 1;
 	ctx.cfg.enable_git_config = 0;
 	ctx.cfg.max_repo_count = 50;
+	ctx.cfg.max_ref_count = 100;
 	ctx.cfg.max_commit_count = 50;
 	ctx.cfg.max_lock_attempts = 5;
 	ctx.cfg.max_msg_len = 80;
@@ -426,6 +469,9 @@ static void prepare_context(void)
 	ctx.env.server_port = getenv("SERVER_PORT");
 	ctx.env.http_cookie = getenv("HTTP_COOKIE");
 	ctx.env.http_referer = getenv("HTTP_REFERER");
+	ctx.env.http_git_protocol = getenv("HTTP_GIT_PROTOCOL");
+	ctx.env.http_content_encoding = getenv("HTTP_CONTENT_ENCODING");
+	ctx.env.http_if_none_match = getenv("HTTP_IF_NONE_MATCH");
 	ctx.env.content_length = getenv("CONTENT_LENGTH") ? strtoul(getenv("CONTENT_LENGTH"), NULL, 10) : 0;
 	ctx.env.authenticated = 0;
 	ctx.page.mimetype = "text/html";
@@ -435,6 +481,7 @@ static void prepare_context(void)
 	ctx.page.modified = time(NULL);
 	ctx.page.expires = ctx.page.modified;
 	ctx.page.etag = NULL;
+	ctx.page.cache_control = NULL;
 	string_list_init_dup(&ctx.cfg.mimetypes);
 	if (ctx.env.script_name)
 		ctx.cfg.script_name = xstrdup(ctx.env.script_name);
@@ -828,6 +875,8 @@ static void print_repo(FILE *f, struct cgit_repo *repo)
 		fprintf(f, "repo.clone-url=%s\n", repo->clone_url);
 	fprintf(f, "repo.enable-blame=%d\n",
 	        repo->enable_blame);
+	fprintf(f, "repo.enable-bloom-filters=%d\n",
+	        repo->enable_bloom_filters);
 	fprintf(f, "repo.enable-commit-graph=%d\n",
 	        repo->enable_commit_graph);
 	fprintf(f, "repo.enable-follow-links=%d\n",
@@ -863,6 +912,9 @@ static void print_repo(FILE *f, struct cgit_repo *repo)
 	fprintf(f, "repo.enable-remote-branches=%d\n", repo->enable_remote_branches);
 	fprintf(f, "repo.enable-subject-links=%d\n", repo->enable_subject_links);
 	fprintf(f, "repo.enable-html-serving=%d\n", repo->enable_html_serving);
+	fprintf(f, "repo.enable-tree-sizes=%d\n", repo->enable_tree_sizes);
+	fprintf(f, "repo.enable-tree-last-commit=%d\n",
+		repo->enable_tree_last_commit);
 	if (repo->branch_sort == 1)
 		fprintf(f, "repo.branch-sort=age\n");
 	if (repo->commit_sort) {
@@ -890,6 +942,7 @@ static void print_repolist(FILE *f, struct cgit_repolist *list, int start)
 static int generate_cached_repolist(const char *path, const char *cached_rc)
 {
 	struct strbuf locked_rc = STRBUF_INIT;
+	struct stat st;
 	int result = 0;
 	int idx;
 	FILE *f;
@@ -912,9 +965,17 @@ static int generate_cached_repolist(const char *path, const char *cached_rc)
 	else
 		scan_tree(path, repo_config);
 	print_repolist(f, &cgit_repolist, idx);
+	if (fflush(f) || fstat(fileno(f), &st))
+		st.st_ino = 0;
 	if (rename(locked_rc.buf, cached_rc))
 		fprintf(stderr, "[cgit] Error renaming %s to %s: %s (%d)\n",
 			locked_rc.buf, cached_rc, strerror(errno), errno);
+	else if (st.st_ino) {
+		cgit_write_repolist_index(cached_rc, &st, &cgit_repolist, idx);
+		cgit_write_repolist_idle(cached_rc, &st, &cgit_repolist, idx);
+		cgit_add_repolist_index(cached_rc, &st, idx,
+					cgit_repolist.count - idx);
+	}
 	fclose(f);
 out:
 	strbuf_release(&locked_rc);
@@ -927,6 +988,7 @@ static void process_cached_repolist(const char *path)
 	struct strbuf cached_rc = STRBUF_INIT;
 	time_t age;
 	unsigned long hash;
+	int first;
 
 	hash = hash_str(path);
 	if (ctx.cfg.project_list)
@@ -948,7 +1010,10 @@ static void process_cached_repolist(const char *path)
 		goto out;
 	}
 
+	first = cgit_repolist.count;
 	parse_configfile(cached_rc.buf, config_cb);
+	cgit_add_repolist_index(cached_rc.buf, &st, first,
+				cgit_repolist.count - first);
 
 	/* If the cached configfile hasn't expired, lets exit now */
 	age = time(NULL) - st.st_mtime;
@@ -967,6 +1032,89 @@ out:
 	strbuf_release(&cached_rc);
 }
 
+static int pregenerate, pregenerate_jobs = 1, update_idle_times;
+
+/* Run `cgit_pregenerate_snapshot(ref)` for `repo` in a new process. */
+static pid_t start_pregenerate_job(struct cgit_repo *repo, const char *ref)
+{
+	pid_t pid;
+	int nongit = 0;
+
+	pid = fork();
+	if (pid)
+		return pid;
+	ctx.repo = repo;
+	prepare_repo_env(&nongit);
+	if (nongit) {
+		fprintf(stderr, "Failed to open %s\n", repo->name);
+		exit(1);
+	}
+	exit(cgit_pregenerate_snapshot(ref));
+}
+
+static int finish_pregenerate_job(void)
+{
+	int status;
+
+	if (waitpid(-1, &status, 0) < 0)
+		return 1;
+	return !WIFEXITED(status) || WEXITSTATUS(status);
+}
+
+/*
+ * Fill the snapshot store with the snapshots of all tags of all
+ * repositories, running up to `jobs` processes at once.
+ */
+static int pregenerate_snapshots(int jobs)
+{
+	struct child_process cmd;
+	struct strbuf tags = STRBUF_INIT;
+	struct string_list refs = STRING_LIST_INIT_NODUP;
+	struct string_list_item *ref;
+	struct cgit_repo *repo;
+	int i, running = 0, err = 0;
+
+	if (ctx.cfg.snapshot_cache_size <= 0) {
+		fprintf(stderr, "The snapshot store is disabled, see snapshot-cache-size\n");
+		return 1;
+	}
+	for (i = 0; i < cgit_repolist.count; i++) {
+		repo = &cgit_repolist.repos[i];
+		if (!repo->snapshots || repo->ignore)
+			continue;
+
+		child_process_init(&cmd);
+		cmd.git_cmd = 1;
+		strvec_pushf(&cmd.env, "GIT_DIR=%s", repo->path);
+		strvec_pushl(&cmd.args, "for-each-ref",
+			     "--format=%(refname:short)", "refs/tags", NULL);
+		strbuf_reset(&tags);
+		if (capture_command(&cmd, &tags, 0)) {
+			fprintf(stderr, "Failed to list tags of %s\n", repo->name);
+			err = 1;
+			continue;
+		}
+
+		string_list_split_in_place(&refs, tags.buf, "\n", -1);
+		string_list_remove_empty_items(&refs, 0);
+		for_each_string_list_item(ref, &refs) {
+			if (running >= jobs) {
+				err |= finish_pregenerate_job();
+				running--;
+			}
+			if (start_pregenerate_job(repo, ref->string) < 0)
+				err = 1;
+			else
+				running++;
+		}
+		string_list_clear(&refs, 0);
+	}
+	while (running--)
+		err |= finish_pregenerate_job();
+	strbuf_release(&tags);
+	return err;
+}
+
 static void cgit_parse_args(int argc, const char **argv)
 {
 	int i;
@@ -1009,6 +1157,14 @@ static void cgit_parse_args(int argc, const char **argv)
 			ctx.qry.has_oid = 1;
 		} else if (skip_prefix(argv[i], "--ofs=", &arg)) {
 			ctx.qry.ofs = atoi(arg);
+		} else if (!strcmp(argv[i], "--update-idle-times")) {
+			update_idle_times = 1;
+		} else if (!strcmp(argv[i], "--pregenerate-snapshots")) {
+			pregenerate = 1;
+		} else if (skip_prefix(argv[i], "--jobs=", &arg)) {
+			pregenerate_jobs = atoi(arg);
+			if (pregenerate_jobs < 1)
+				pregenerate_jobs = 1;
 		} else if (skip_prefix(argv[i], "--scan-tree=", &arg) ||
 		           skip_prefix(argv[i], "--scan-path=", &arg)) {
 			/*
@@ -1080,6 +1236,12 @@ int cmd_main(int argc, const char **argv)
 
 	cgit_parse_args(argc, argv);
 	parse_configfile(expand_macros(ctx.env.cgit_config), config_cb);
+	if (update_idle_times) {
+		cgit_refresh_repolist_idle();
+		exit(0);
+	}
+	if (pregenerate)
+		exit(pregenerate_snapshots(pregenerate_jobs));
 	ctx.repo = NULL;
 	http_parse_querystring(ctx.qry.raw, querystring_cb);
 
@@ -1121,6 +1283,18 @@ int cmd_main(int argc, const char **argv)
 		ctx.page.expires += ttl * 60;
 	if (!ctx.env.authenticated || (ctx.env.request_method && !strcmp(ctx.env.request_method, "HEAD")))
 		ctx.cfg.cache_size = 0;
+	/* Smart HTTP responses depend on the request headers and body. */
+	if (ctx.qry.service ||
+	    (ctx.qry.page && !strcmp(ctx.qry.page, "git-upload-pack")))
+		ctx.cfg.cache_size = 0;
+	/* Atom feeds are kept in the fragment cache by their tip instead, so
+	 * that they are up to date and can be revalidated through their ETag.
+	 * A "304 Not Modified" answer must not be stored for later requests
+	 * either.
+	 */
+	if ((ctx.cfg.enable_fragment_cache || ctx.env.http_if_none_match) &&
+	    ctx.qry.page && !strcmp(ctx.qry.page, "atom"))
+		ttl = 0;
 	err = cache_process(ctx.cfg.cache_size, ctx.cfg.cache_root,
 			    ctx.qry.raw, ttl, process_request);
 	cgit_cleanup_filters();
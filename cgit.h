@@ -100,6 +100,7 @@ struct cgit_repo {
 	char *snapshot_prefix;
 	int snapshots;
 	int enable_blame;
+	int enable_bloom_filters;
 	int enable_commit_graph;
 	int enable_follow_links;
 	int enable_log_filecount;
@@ -107,6 +108,8 @@ struct cgit_repo {
 	int enable_remote_branches;
 	int enable_subject_links;
 	int enable_html_serving;
+	int enable_tree_sizes;
+	int enable_tree_last_commit;
 	int max_stats;
 	int branch_sort;
 	int commit_sort;
@@ -187,6 +190,7 @@ struct cgit_query {
 	int   ofs;
 	int nohead;
 	char *sort;
+	char *service;
 	int showmsg;
 	diff_type difftype;
 	int show_all;
@@ -235,9 +239,11 @@ struct cgit_config {
 	int enable_filter_overrides;
 	int enable_follow_links;
 	int enable_http_clone;
+	int enable_smart_http;
 	int enable_index_links;
 	int enable_index_owner;
 	int enable_blame;
+	int enable_bloom_filters;
 	int enable_commit_graph;
 	int enable_log_filecount;
 	int enable_log_linecount;
@@ -245,10 +251,18 @@ struct cgit_config {
 	int enable_subject_links;
 	int enable_html_serving;
 	int enable_tree_linenumbers;
+	int enable_tree_sizes;
+	int enable_tree_last_commit;
 	int enable_git_config;
+	int enable_blame_cache;
+	int enable_fragment_cache;
+	int enable_rename_cache;
+	int enable_stats_cache;
+	int enable_snapshot_staging;
 	int local_time;
 	int max_atom_items;
 	int max_repo_count;
+	int max_ref_count;
 	int max_commit_count;
 	int max_lock_attempts;
 	int max_msg_len;
@@ -258,10 +272,14 @@ struct cgit_config {
 	int noplainemail;
 	int noheader;
 	int renamelimit;
+	int rename_budget;
+	int blame_budget;
 	int remove_suffix;
 	int scan_hidden_path;
 	int section_from_path;
 	int snapshots;
+	int snapshot_cache_size;
+	int snapshot_threads;
 	int section_sort;
 	int summary_branches;
 	int summary_log;
@@ -287,6 +305,7 @@ struct cgit_page {
 	const char *charset;
 	const char *filename;
 	const char *etag;
+	const char *cache_control;
 	const char *title;
 	int status;
 	const char *statusmsg;
@@ -305,6 +324,9 @@ struct cgit_environment {
 	const char *server_port;
 	const char *http_cookie;
 	const char *http_referer;
+	const char *http_git_protocol;
+	const char *http_content_encoding;
+	const char *http_if_none_match;
 	unsigned int content_length;
 	int authenticated;
 };
@@ -346,8 +368,11 @@ extern char *ensure_end(const char *str, char c);
 extern void strbuf_ensure_end(struct strbuf *sb, char c);
 
 extern void cgit_add_ref(struct reflist *list, struct refinfo *ref);
+extern struct refinfo *cgit_mk_refinfo(const char *refname,
+				       const struct object_id *oid);
 extern void cgit_free_reflist_inner(struct reflist *list);
 extern int cgit_refs_cb(const struct reference *ref, void *cb_data);
+extern void cgit_get_ref_state(struct object_id *oid);
 
 extern void cgit_free_commitinfo(struct commitinfo *info);
 extern void cgit_free_taginfo(struct taginfo *info);
@@ -368,6 +393,12 @@ extern void cgit_diff_tree(const struct object_id *old_oid,
 extern void cgit_diff_commit(struct commit *commit, filepair_fn fn,
 			     const char *prefix);
 
+extern const char *cgit_diff_rename_warning(void);
+extern int cgit_diff_rename_budget_exceeded(void);
+
+extern int cgit_commit_may_change_path(struct commit *commit, const char *path);
+extern void cgit_update_bloom_filters(const char *tip);
+
 __attribute__((format (printf,1,2)))
 extern char *fmt(const char *format,...);
 
@@ -397,6 +428,8 @@ extern void cgit_prepare_repo_env(struct cgit_repo * repo);
 
 extern int readfile(const char *path, char **buf, size_t *size);
 
+extern int cgit_get_repo_modtime(const struct cgit_repo *repo, time_t *mtime);
+
 extern char *expand_macros(const char *txt);
 
 extern char *get_mimetype_for_filename(const char *filename);
@@ -74,6 +74,7 @@ CGIT_OBJ_NAMES += configfile.o
 CGIT_OBJ_NAMES += filter.o
 CGIT_OBJ_NAMES += html.o
 CGIT_OBJ_NAMES += parsing.o
+CGIT_OBJ_NAMES += repolist-index.o
 CGIT_OBJ_NAMES += scan-tree.o
 CGIT_OBJ_NAMES += shared.o
 CGIT_OBJ_NAMES += ui-atom.o
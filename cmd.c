@@ -92,6 +92,11 @@ static void rawdiff_fn(void)
 	cgit_print_diff(ctx.qry.oid, ctx.qry.oid2, ctx.qry.path, 1, 1);
 }
 
+static void git_upload_pack_fn(void)
+{
+	cgit_clone_upload_pack();
+}
+
 static void info_fn(void)
 {
 	cgit_clone_info();
@@ -123,6 +128,11 @@ static void repolist_fn(void)
 	cgit_print_repolist();
 }
 
+static void repolist_json_fn(void)
+{
+	cgit_print_repolist_json();
+}
+
 static void patch_fn(void)
 {
 	cgit_print_patch(ctx.qry.oid, ctx.qry.oid2, ctx.qry.path);
@@ -177,6 +187,7 @@ struct cgit_cmd *cgit_get_cmd(void)
 		def_cmd(blob, 1, 0, 0),
 		def_cmd(commit, 1, 1, 0),
 		def_cmd(diff, 1, 1, 0),
+		{"git-upload-pack", git_upload_pack_fn, 1, 0, 1},
 		def_cmd(info, 1, 0, 1),
 		def_cmd(log, 1, 1, 0),
 		def_cmd(ls_cache, 0, 0, 0),
@@ -186,6 +197,7 @@ struct cgit_cmd *cgit_get_cmd(void)
 		def_cmd(rawdiff, 1, 1, 0),
 		def_cmd(refs, 1, 0, 0),
 		def_cmd(repolist, 0, 0, 0),
+		def_cmd(repolist_json, 0, 0, 0),
 		def_cmd(snapshot, 1, 0, 0),
 		def_cmd(stats, 1, 1, 0),
 		def_cmd(summary, 1, 0, 0),
@@ -256,6 +256,84 @@ void html_header_arg_in_quotes(const char *txt)
 
 }
 
+/* Return the length of the well-formed UTF-8 sequence at `s`, or 0. */
+static size_t utf8_sequence_length(const unsigned char *s)
+{
+	unsigned int cp;
+	size_t len, i;
+
+	if (s[0] < 0x80)
+		return 1;
+	if (s[0] >= 0xc2 && s[0] <= 0xdf) {
+		len = 2;
+		cp = s[0] & 0x1f;
+	} else if ((s[0] & 0xf0) == 0xe0) {
+		len = 3;
+		cp = s[0] & 0x0f;
+	} else if (s[0] >= 0xf0 && s[0] <= 0xf4) {
+		len = 4;
+		cp = s[0] & 0x07;
+	} else
+		return 0;
+	/* The terminating NUL is no continuation byte either. */
+	for (i = 1; i < len; i++) {
+		if ((s[i] & 0xc0) != 0x80)
+			return 0;
+		cp = (cp << 6) | (s[i] & 0x3f);
+	}
+	if (len == 3 && (cp < 0x800 || (cp >= 0xd800 && cp <= 0xdfff)))
+		return 0;
+	if (len == 4 && (cp < 0x10000 || cp > 0x10ffff))
+		return 0;
+	return len;
+}
+
+/* Print `txt` as a JSON string. Bytes which are not part of valid UTF-8
+ * are replaced by U+FFFD, as JSON text must be UTF-8.
+ */
+void html_json_string(const char *txt)
+{
+	const char *t = txt;
+	size_t len;
+
+	if (!txt) {
+		html("null");
+		return;
+	}
+	html("\"");
+	while (*t) {
+		unsigned char c = *t;
+		if (c == '"' || c == '\\' || c < 0x20) {
+			html_raw(txt, t - txt);
+			if (c == '"')
+				html("\\\"");
+			else if (c == '\\')
+				html("\\\\");
+			else if (c == '\n')
+				html("\\n");
+			else if (c == '\t')
+				html("\\t");
+			else
+				htmlf("\\u%04x", c);
+			txt = t + 1;
+		} else if (c >= 0x80) {
+			len = utf8_sequence_length((const unsigned char *)t);
+			if (!len) {
+				html_raw(txt, t - txt);
+				html("\\ufffd");
+				txt = t + 1;
+			} else {
+				t += len;
+				continue;
+			}
+		}
+		t++;
+	}
+	if (t != txt)
+		html_raw(txt, t - txt);
+	html("\"");
+}
+
 void html_hidden(const char *name, const char *value)
 {
 	html("<input type='hidden' name='");
@@ -0,0 +1,698 @@
+/* repolist-index.c: search index and idle table for cached repolists
+ *
+ * Copyright (C) 2006-2014 cgit Development Team <cgit@lists.zx2c4.com>
+ *
+ * Licensed under GNU General Public License v2
+ *   (see COPYING for full license text)
+ *
+ *
+ * The index of a cached repolist lists, for every trigram found in the
+ * url, name, description or owner of its repositories (case-folded), the
+ * positions of the repositories containing it. It is stored next to the
+ * cached repolist in native byte order: a header, the trigrams sorted by
+ * value, and the sorted positions of each trigram.
+ *
+ * The idle table of a cached repolist holds the modification time of each
+ * of its repositories, as found by cgit_get_repo_modtime(), after the same
+ * header. Its sort orders, written along with it, hold the number of
+ * repositories which are neither hidden nor ignored, and list the
+ * positions of those repositories sorted by each column of the index
+ * page and in the order of the repolist. Both are written while the
+ * configuration is still being read, so their headers also record the
+ * agefile setting they were made with and they are ignored when it has
+ * changed by the end of the configuration.
+ */
+
+#include "cgit.h"
+#include "repolist-index.h"
+#include "hashmap.h"
+
+#define INDEX_MAGIC "CGITIDX1"
+#define IDLE_MAGIC "CGITIDL2"
+#define SORT_MAGIC "CGITSRT3"
+
+#define SORT_CASE_SENSITIVE 1
+#define SORT_SECTION_AGE 2
+
+/* The last order, without a field, is the one of the repolist. */
+static const char *sort_fields[] = {
+	"section", "name", "desc", "owner", "idle", NULL
+};
+
+struct index_header {
+	char magic[8];
+	uint64_t rc_ino;
+	uint64_t rc_size;
+	uint64_t rc_mtime;
+	uint32_t nr_repos;
+	uint32_t info;	/* trigrams in the index, flags of the sort orders */
+	uint32_t agefile;	/* hash of the agefile of idle times */
+};
+
+struct index_trigram {
+	uint32_t trigram;
+	uint32_t offset;
+	uint32_t count;
+};
+
+struct repolist_index {
+	char *path;
+	char *idle_path;
+	char *sort_path;
+	struct stat rc_st;
+	int first;
+	int nr;
+};
+
+static struct repolist_index *indexes;
+static size_t indexes_nr, indexes_alloc;
+
+static char *index_path(const char *cached_rc)
+{
+	return xstrfmt("%s.idx", cached_rc);
+}
+
+static char *idle_path(const char *cached_rc)
+{
+	return xstrfmt("%s.idle", cached_rc);
+}
+
+static char *sort_path(const char *cached_rc)
+{
+	return xstrfmt("%s.sort", cached_rc);
+}
+
+static void init_header(struct index_header *header, const char *magic,
+			const struct stat *rc_st, int nr_repos)
+{
+	memset(header, 0, sizeof(*header));
+	memcpy(header->magic, magic, sizeof(header->magic));
+	header->rc_ino = rc_st->st_ino;
+	header->rc_size = rc_st->st_size;
+	header->rc_mtime = rc_st->st_mtime;
+	header->nr_repos = nr_repos;
+}
+
+static uint32_t agefile_hash(void)
+{
+	return strhash(ctx.cfg.agefile);
+}
+
+static int check_header(const struct index_header *header, const char *magic,
+			const struct repolist_index *index)
+{
+	return !memcmp(header->magic, magic, sizeof(header->magic)) &&
+	       header->rc_ino == (uint64_t)index->rc_st.st_ino &&
+	       header->rc_size == (uint64_t)index->rc_st.st_size &&
+	       header->rc_mtime == (uint64_t)index->rc_st.st_mtime &&
+	       header->nr_repos == index->nr;
+}
+
+/* Open a lockfile for `path`, returning its descriptor or -1. */
+static int lock_path(const char *path, struct strbuf *lockname)
+{
+	strbuf_addf(lockname, "%s.lock", path);
+	return open(lockname->buf, O_WRONLY | O_CREAT | O_EXCL, 0644);
+}
+
+/* Close the lockfile of `path`, replacing `path` with it unless `err`. */
+static void commit_path(const char *path, struct strbuf *lockname, int fd,
+			int err)
+{
+	if (close(fd))
+		err = 1;
+	if (err || rename(lockname->buf, path))
+		unlink(lockname->buf);
+	strbuf_release(lockname);
+}
+
+static uint32_t trigram_at(const char *s)
+{
+	return (uint32_t)tolower((unsigned char)s[0]) << 16 |
+	       (uint32_t)tolower((unsigned char)s[1]) << 8 |
+	       (uint32_t)tolower((unsigned char)s[2]);
+}
+
+struct trigram_ref {
+	uint32_t trigram;
+	uint32_t repo;
+};
+
+struct trigram_refs {
+	struct trigram_ref *items;
+	size_t nr, alloc;
+};
+
+static void add_trigrams(struct trigram_refs *refs, const char *s,
+			 uint32_t repo)
+{
+	size_t i, len;
+
+	if (!s)
+		return;
+	len = strlen(s);
+	for (i = 0; i + 2 < len; i++) {
+		ALLOC_GROW(refs->items, refs->nr + 1, refs->alloc);
+		refs->items[refs->nr].trigram = trigram_at(s + i);
+		refs->items[refs->nr].repo = repo;
+		refs->nr++;
+	}
+}
+
+static int cmp_trigram_ref(const void *a, const void *b)
+{
+	const struct trigram_ref *ra = a, *rb = b;
+
+	if (ra->trigram != rb->trigram)
+		return ra->trigram < rb->trigram ? -1 : 1;
+	if (ra->repo != rb->repo)
+		return ra->repo < rb->repo ? -1 : 1;
+	return 0;
+}
+
+void cgit_write_repolist_index(const char *cached_rc,
+			       const struct stat *rc_st,
+			       const struct cgit_repolist *list, int start)
+{
+	struct trigram_refs refs = { 0 };
+	struct index_header header;
+	struct index_trigram *trigrams = NULL;
+	uint32_t *postings = NULL;
+	size_t i, nr = 0, alloc = 0, postings_nr = 0;
+	struct strbuf lockname = STRBUF_INIT;
+	char *path = index_path(cached_rc);
+	int fd, i_repo, err;
+
+	for (i_repo = start; i_repo < list->count; i_repo++) {
+		const struct cgit_repo *repo = &list->repos[i_repo];
+		uint32_t pos = i_repo - start;
+
+		add_trigrams(&refs, repo->url, pos);
+		add_trigrams(&refs, repo->name, pos);
+		add_trigrams(&refs, repo->desc, pos);
+		add_trigrams(&refs, repo->owner, pos);
+	}
+	QSORT(refs.items, refs.nr, cmp_trigram_ref);
+
+	ALLOC_ARRAY(postings, refs.nr);
+	for (i = 0; i < refs.nr; i++) {
+		if (i && !cmp_trigram_ref(&refs.items[i - 1], &refs.items[i]))
+			continue;
+		if (!nr || trigrams[nr - 1].trigram != refs.items[i].trigram) {
+			ALLOC_GROW(trigrams, nr + 1, alloc);
+			trigrams[nr].trigram = refs.items[i].trigram;
+			trigrams[nr].offset = postings_nr;
+			trigrams[nr].count = 0;
+			nr++;
+		}
+		trigrams[nr - 1].count++;
+		postings[postings_nr++] = refs.items[i].repo;
+	}
+
+	init_header(&header, INDEX_MAGIC, rc_st, list->count - start);
+	header.info = nr;
+
+	fd = lock_path(path, &lockname);
+	if (fd < 0) {
+		strbuf_release(&lockname);
+		goto out;
+	}
+	err = write_in_full(fd, &header, sizeof(header)) < 0 ||
+	      write_in_full(fd, trigrams, st_mult(nr, sizeof(*trigrams))) < 0 ||
+	      write_in_full(fd, postings,
+			    st_mult(postings_nr, sizeof(*postings))) < 0;
+	commit_path(path, &lockname, fd, err);
+out:
+	free(path);
+	free(postings);
+	free(trigrams);
+	free(refs.items);
+}
+
+/* Collation data of a repository, where NULL keys sort last. */
+struct sort_key {
+	char *section, *name, *desc, *owner;
+	time_t mtime;
+	uint32_t pos;
+};
+
+static char *collation_key(const char *s)
+{
+	char *key, *p;
+
+	if (!s)
+		return NULL;
+	key = xstrdup(s);
+	if (!ctx.cfg.case_sensitive_sort)
+		for (p = key; *p; p++)
+			*p = tolower((unsigned char)*p);
+	return key;
+}
+
+static int cmp_key(const char *s1, const char *s2)
+{
+	if (s1 && s2)
+		return strcmp(s1, s2);
+	if (s1 && !s2)
+		return -1;
+	if (s2 && !s1)
+		return 1;
+	return 0;
+}
+
+static int cmp_pos(const struct sort_key *k1, const struct sort_key *k2)
+{
+	return k1->pos < k2->pos ? -1 : k1->pos > k2->pos;
+}
+
+static int cmp_idle_key(const struct sort_key *k1, const struct sort_key *k2)
+{
+	return k1->mtime > k2->mtime ? -1 : k1->mtime < k2->mtime;
+}
+
+static int sort_key_name(const void *a, const void *b)
+{
+	const struct sort_key *k1 = a, *k2 = b;
+	int result = cmp_key(k1->name, k2->name);
+
+	return result ? result : cmp_pos(k1, k2);
+}
+
+static int sort_key_desc(const void *a, const void *b)
+{
+	const struct sort_key *k1 = a, *k2 = b;
+	int result = cmp_key(k1->desc, k2->desc);
+
+	return result ? result : cmp_pos(k1, k2);
+}
+
+static int sort_key_owner(const void *a, const void *b)
+{
+	const struct sort_key *k1 = a, *k2 = b;
+	int result = cmp_key(k1->owner, k2->owner);
+
+	return result ? result : cmp_pos(k1, k2);
+}
+
+static int sort_key_idle(const void *a, const void *b)
+{
+	const struct sort_key *k1 = a, *k2 = b;
+	int result = cmp_idle_key(k1, k2);
+
+	return result ? result : cmp_pos(k1, k2);
+}
+
+static int sort_key_section(const void *a, const void *b)
+{
+	const struct sort_key *k1 = a, *k2 = b;
+	int result;
+
+	result = cmp_key(k1->section, k2->section);
+	if (!result && !strcmp(ctx.cfg.repository_sort, "age"))
+		result = cmp_idle_key(k1, k2);
+	if (!result)
+		result = cmp_key(k1->name, k2->name);
+	return result ? result : cmp_pos(k1, k2);
+}
+
+static int sort_key_pos(const void *a, const void *b)
+{
+	return cmp_pos(a, b);
+}
+
+/* In the order of sort_fields. */
+static int (*sort_key_fns[])(const void *a, const void *b) = {
+	sort_key_section, sort_key_name, sort_key_desc, sort_key_owner,
+	sort_key_idle, sort_key_pos
+};
+
+static uint32_t sort_flags(void)
+{
+	uint32_t flags = 0;
+
+	if (ctx.cfg.case_sensitive_sort)
+		flags |= SORT_CASE_SENSITIVE;
+	if (!strcmp(ctx.cfg.repository_sort, "age"))
+		flags |= SORT_SECTION_AGE;
+	return flags;
+}
+
+static void write_sort_orders(const char *path, const struct stat *rc_st,
+			      struct cgit_repo *repos, int nr)
+{
+	struct index_header header;
+	struct strbuf lockname = STRBUF_INIT;
+	struct sort_key *keys;
+	uint32_t *orders, visible;
+	size_t field;
+	int fd, i, err, nr_visible = 0;
+
+	ALLOC_ARRAY(keys, nr);
+	for (i = 0; i < nr; i++) {
+		struct sort_key *key = &keys[nr_visible];
+
+		if (repos[i].hide || repos[i].ignore)
+			continue;
+		key->section = collation_key(repos[i].section);
+		key->name = collation_key(repos[i].name);
+		key->desc = collation_key(repos[i].desc);
+		key->owner = collation_key(repos[i].owner);
+		key->mtime = 0;
+		cgit_get_repo_modtime(&repos[i], &key->mtime);
+		key->pos = i;
+		nr_visible++;
+	}
+	ALLOC_ARRAY(orders, st_mult(nr_visible, ARRAY_SIZE(sort_fields)));
+	for (field = 0; field < ARRAY_SIZE(sort_fields); field++) {
+		QSORT(keys, nr_visible, sort_key_fns[field]);
+		for (i = 0; i < nr_visible; i++)
+			orders[field * nr_visible + i] = keys[i].pos;
+	}
+	init_header(&header, SORT_MAGIC, rc_st, nr);
+	header.info = sort_flags();
+	header.agefile = agefile_hash();
+	visible = nr_visible;
+
+	fd = lock_path(path, &lockname);
+	if (fd < 0) {
+		strbuf_release(&lockname);
+		goto out;
+	}
+	err = write_in_full(fd, &header, sizeof(header)) < 0 ||
+	      write_in_full(fd, &visible, sizeof(visible)) < 0 ||
+	      write_in_full(fd, orders,
+			    st_mult(nr_visible, ARRAY_SIZE(sort_fields) *
+				    sizeof(*orders))) < 0;
+	commit_path(path, &lockname, fd, err);
+out:
+	for (i = 0; i < nr_visible; i++) {
+		free(keys[i].section);
+		free(keys[i].name);
+		free(keys[i].desc);
+		free(keys[i].owner);
+	}
+	free(keys);
+	free(orders);
+}
+
+static void write_idle_table(const char *path, const struct stat *rc_st,
+			     struct cgit_repo *repos, int nr)
+{
+	struct index_header header;
+	struct strbuf lockname = STRBUF_INIT;
+	int64_t *mtimes;
+	int fd, i, err;
+
+	ALLOC_ARRAY(mtimes, nr);
+	for (i = 0; i < nr; i++) {
+		time_t t = 0;
+
+		cgit_get_repo_modtime(&repos[i], &t);
+		mtimes[i] = t;
+	}
+	init_header(&header, IDLE_MAGIC, rc_st, nr);
+	header.agefile = agefile_hash();
+
+	fd = lock_path(path, &lockname);
+	if (fd < 0) {
+		strbuf_release(&lockname);
+		free(mtimes);
+		return;
+	}
+	err = write_in_full(fd, &header, sizeof(header)) < 0 ||
+	      write_in_full(fd, mtimes, st_mult(nr, sizeof(*mtimes))) < 0;
+	commit_path(path, &lockname, fd, err);
+	free(mtimes);
+}
+
+void cgit_write_repolist_idle(const char *cached_rc, const struct stat *rc_st,
+			      struct cgit_repolist *list, int start)
+{
+	char *path = idle_path(cached_rc);
+	int i;
+
+	write_idle_table(path, rc_st, list->repos + start, list->count - start);
+	free(path);
+	path = sort_path(cached_rc);
+	write_sort_orders(path, rc_st, list->repos + start, list->count - start);
+	free(path);
+	/* A later agefile setting applies to the times shown. */
+	for (i = start; i < list->count; i++)
+		list->repos[i].mtime = -1;
+}
+
+void cgit_add_repolist_index(const char *cached_rc, const struct stat *rc_st,
+			     int first, int nr)
+{
+	ALLOC_GROW(indexes, indexes_nr + 1, indexes_alloc);
+	indexes[indexes_nr].path = index_path(cached_rc);
+	indexes[indexes_nr].idle_path = idle_path(cached_rc);
+	indexes[indexes_nr].sort_path = sort_path(cached_rc);
+	indexes[indexes_nr].rc_st = *rc_st;
+	indexes[indexes_nr].first = first;
+	indexes[indexes_nr].nr = nr;
+	indexes_nr++;
+}
+
+static int valid_index(const struct repolist_index *index)
+{
+	return index->first + index->nr <= cgit_repolist.count;
+}
+
+void cgit_load_repolist_idle(void)
+{
+	struct index_header header;
+	int64_t *mtimes = NULL;
+	size_t i;
+	int fd, j;
+
+	for (i = 0; i < indexes_nr; i++) {
+		const struct repolist_index *index = &indexes[i];
+		size_t size = st_mult(index->nr, sizeof(*mtimes));
+
+		if (!valid_index(index))
+			continue;
+		fd = open(index->idle_path, O_RDONLY);
+		if (fd < 0)
+			continue;
+		mtimes = xrealloc(mtimes, size);
+		if (read_in_full(fd, &header, sizeof(header)) == (ssize_t)sizeof(header) &&
+		    check_header(&header, IDLE_MAGIC, index) &&
+		    header.agefile == agefile_hash() &&
+		    read_in_full(fd, mtimes, size) == (ssize_t)size) {
+			for (j = 0; j < index->nr; j++)
+				cgit_repolist.repos[index->first + j].mtime = mtimes[j];
+		}
+		close(fd);
+	}
+	free(mtimes);
+}
+
+void cgit_refresh_repolist_idle(void)
+{
+	size_t i;
+
+	for (i = 0; i < indexes_nr; i++) {
+		const struct repolist_index *index = &indexes[i];
+
+		if (!valid_index(index))
+			continue;
+		write_idle_table(index->idle_path, &index->rc_st,
+				 cgit_repolist.repos + index->first, index->nr);
+		write_sort_orders(index->sort_path, &index->rc_st,
+				  cgit_repolist.repos + index->first, index->nr);
+	}
+}
+
+int *cgit_get_repolist_order(const char *field, int *nr)
+{
+	const struct repolist_index *index = NULL;
+	struct index_header header;
+	uint32_t *order = NULL, nr_visible;
+	int *result = NULL;
+	size_t i, size;
+	int fd, j;
+
+	for (i = 0; i < indexes_nr; i++) {
+		if (indexes[i].first == 0 &&
+		    indexes[i].nr == cgit_repolist.count)
+			index = &indexes[i];
+	}
+	for (i = 0; i < ARRAY_SIZE(sort_fields); i++) {
+		if (!field ? !sort_fields[i] :
+		    sort_fields[i] && !strcmp(field, sort_fields[i]))
+			break;
+	}
+	if (!index || i == ARRAY_SIZE(sort_fields))
+		return NULL;
+
+	fd = open(index->sort_path, O_RDONLY);
+	if (fd < 0)
+		return NULL;
+	if (read_in_full(fd, &header, sizeof(header)) != (ssize_t)sizeof(header) ||
+	    !check_header(&header, SORT_MAGIC, index) ||
+	    header.info != sort_flags() ||
+	    header.agefile != agefile_hash() ||
+	    read_in_full(fd, &nr_visible, sizeof(nr_visible)) != (ssize_t)sizeof(nr_visible) ||
+	    nr_visible > (uint32_t)index->nr)
+		goto out;
+	size = st_mult(nr_visible, sizeof(*order));
+	order = xmalloc(size);
+	if (pread_in_full(fd, order, size,
+			  sizeof(header) + sizeof(nr_visible) + i * size) != (ssize_t)size)
+		goto out;
+	result = xmalloc(st_mult(nr_visible, sizeof(*result)));
+	for (j = 0; j < (int)nr_visible; j++) {
+		if (order[j] >= (uint32_t)index->nr) {
+			FREE_AND_NULL(result);
+			goto out;
+		}
+		result[j] = order[j];
+	}
+	*nr = nr_visible;
+out:
+	close(fd);
+	free(order);
+	return result;
+}
+
+static const struct index_trigram *find_trigram(const struct index_trigram *trigrams,
+						uint32_t nr, uint32_t trigram)
+{
+	uint32_t lo = 0, hi = nr;
+
+	while (lo < hi) {
+		uint32_t mi = lo + (hi - lo) / 2;
+
+		if (trigrams[mi].trigram == trigram)
+			return &trigrams[mi];
+		if (trigrams[mi].trigram < trigram)
+			lo = mi + 1;
+		else
+			hi = mi;
+	}
+	return NULL;
+}
+
+static int has_posting(const uint32_t *postings, uint32_t nr, uint32_t repo)
+{
+	uint32_t lo = 0, hi = nr;
+
+	while (lo < hi) {
+		uint32_t mi = lo + (hi - lo) / 2;
+
+		if (postings[mi] == repo)
+			return 1;
+		if (postings[mi] < repo)
+			lo = mi + 1;
+		else
+			hi = mi;
+	}
+	return 0;
+}
+
+/*
+ * Check the repositories of `index` which contain all trigrams of `query`
+ * (of at least three characters). Returns -1 if the index can not be
+ * used, in which case nothing has been checked.
+ */
+static int search_index(const struct repolist_index *index, const char *query,
+			char *match, int (*is_match)(struct cgit_repo *repo))
+{
+	const struct index_header *header;
+	const struct index_trigram *trigrams, **found = NULL, *shortest;
+	const uint32_t *postings;
+	struct stat st;
+	size_t i, len, nr = 0, total;
+	uint32_t j;
+	void *map;
+	int fd, ret = -1;
+
+	len = strlen(query);
+	if (len < 3)
+		return -1;
+	fd = open(index->path, O_RDONLY);
+	if (fd < 0)
+		return -1;
+	if (fstat(fd, &st) || (size_t)st.st_size < sizeof(*header)) {
+		close(fd);
+		return -1;
+	}
+	map = xmmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+
+	header = map;
+	if (!check_header(header, INDEX_MAGIC, index))
+		goto out;
+	total = (st.st_size - sizeof(*header)) / sizeof(*trigrams);
+	if (header->info > total)
+		goto out;
+	trigrams = (const struct index_trigram *)(header + 1);
+	postings = (const uint32_t *)(trigrams + header->info);
+	total = (st.st_size - sizeof(*header) -
+		 header->info * sizeof(*trigrams)) / sizeof(*postings);
+
+	ALLOC_ARRAY(found, len - 2);
+	shortest = NULL;
+	for (i = 0; i + 2 < len; i++) {
+		const struct index_trigram *t;
+
+		t = find_trigram(trigrams, header->info,
+				 trigram_at(query + i));
+		if (!t) {
+			/* No repository contains the query. */
+			ret = 0;
+			goto out;
+		}
+		if ((size_t)t->offset + t->count > total)
+			goto out;
+		if (!shortest || t->count < shortest->count)
+			shortest = t;
+		found[nr++] = t;
+	}
+
+	for (j = 0; j < shortest->count; j++) {
+		uint32_t repo = postings[shortest->offset + j];
+
+		if (repo >= header->nr_repos)
+			goto out;
+		for (i = 0; i < nr; i++) {
+			if (!has_posting(postings + found[i]->offset,
+					 found[i]->count, repo))
+				break;
+		}
+		if (i < nr)
+			continue;
+		repo += index->first;
+		match[repo] = is_match(&cgit_repolist.repos[repo]);
+	}
+	ret = 0;
+out:
+	free(found);
+	munmap(map, st.st_size);
+	return ret;
+}
+
+void cgit_search_repolist(const char *query, char *match,
+			  int (*is_match)(struct cgit_repo *repo))
+{
+	char *checked = xcalloc(cgit_repolist.count, 1);
+	size_t i;
+	int j;
+
+	memset(match, 0, cgit_repolist.count);
+	for (i = 0; i < indexes_nr; i++) {
+		const struct repolist_index *index = &indexes[i];
+
+		if (!valid_index(index))
+			continue;
+		if (search_index(index, query, match, is_match))
+			continue;
+		memset(checked + index->first, 1, index->nr);
+	}
+	for (j = 0; j < cgit_repolist.count; j++) {
+		if (!checked[j])
+			match[j] = is_match(&cgit_repolist.repos[j]);
+	}
+	free(checked);
+}
@@ -0,0 +1,53 @@
+#ifndef REPOLIST_INDEX_H
+#define REPOLIST_INDEX_H
+
+/* Write the index of the repositories from `start` on in `list`, which
+ * have been stored in the cached repolist `cached_rc` with the stat data
+ * `rc_st`.
+ */
+extern void cgit_write_repolist_index(const char *cached_rc,
+				      const struct stat *rc_st,
+				      const struct cgit_repolist *list,
+				      int start);
+
+/* Write the idle table and the sort orders of the repositories from
+ * `start` on in `list`, which have been stored in the cached repolist
+ * `cached_rc` with the stat data `rc_st`.
+ */
+extern void cgit_write_repolist_idle(const char *cached_rc,
+				     const struct stat *rc_st,
+				     struct cgit_repolist *list, int start);
+
+/* Note that the `nr` repositories from `first` on in cgit_repolist were
+ * read from the cached repolist `cached_rc` with the stat data `rc_st`.
+ */
+extern void cgit_add_repolist_index(const char *cached_rc,
+				    const struct stat *rc_st,
+				    int first, int nr);
+
+/* Set the mtime of the repositories read from cached repolists to the
+ * values in their idle tables.
+ */
+extern void cgit_load_repolist_idle(void);
+
+/* Rewrite the idle tables and sort orders of all cached repolists which
+ * have been read.
+ */
+extern void cgit_refresh_repolist_idle(void);
+
+/* Return the positions in cgit_repolist of the repositories which are
+ * neither hidden nor ignored, sorted by the index column `field` or, if
+ * it is NULL, in the order of the repolist, and store their number in
+ * `nr`. Returns NULL if the repositories are not all part of a cached
+ * repolist with sort orders for the current sort options.
+ */
+extern int *cgit_get_repolist_order(const char *field, int *nr);
+
+/* Set match[i] for each repository cgit_repolist.repos[i] for which
+ * `is_match` is true. Indexed repositories are only checked if they
+ * contain every trigram of the case-folded `query`.
+ */
+extern void cgit_search_repolist(const char *query, char *match,
+				 int (*is_match)(struct cgit_repo *repo));
+
+#endif /* REPOLIST_INDEX_H */
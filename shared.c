@@ -9,6 +9,11 @@
 #define USE_THE_REPOSITORY_VARIABLE
 
 #include "cgit.h"
+#include "cache.h"
+#include "bloom.h"
+#include "commit-graph.h"
+#include "object-file.h"
+#include "run-command.h"
 
 struct cgit_repolist cgit_repolist;
 struct cgit_context ctx;
@@ -61,9 +66,12 @@ struct cgit_repo *cgit_add_repo(const char *url)
 	ret->section = ctx.cfg.section;
 	ret->snapshots = ctx.cfg.snapshots;
 	ret->enable_blame = ctx.cfg.enable_blame;
+	ret->enable_bloom_filters = ctx.cfg.enable_bloom_filters;
 	ret->enable_commit_graph = ctx.cfg.enable_commit_graph;
 	ret->enable_follow_links = ctx.cfg.enable_follow_links;
 	ret->enable_log_filecount = ctx.cfg.enable_log_filecount;
+	ret->enable_tree_sizes = ctx.cfg.enable_tree_sizes;
+	ret->enable_tree_last_commit = ctx.cfg.enable_tree_last_commit;
 	ret->enable_log_linecount = ctx.cfg.enable_log_linecount;
 	ret->enable_remote_branches = ctx.cfg.enable_remote_branches;
 	ret->enable_subject_links = ctx.cfg.enable_subject_links;
@@ -159,7 +167,7 @@ void cgit_add_ref(struct reflist *list, struct refinfo *ref)
 	list->refs[list->count++] = ref;
 }
 
-static struct refinfo *cgit_mk_refinfo(const char *refname, const struct object_id *oid)
+struct refinfo *cgit_mk_refinfo(const char *refname, const struct object_id *oid)
 {
 	struct refinfo *ref;
 
@@ -223,6 +231,23 @@ int cgit_refs_cb(const struct reference *ref, void *cb_data)
 	return 0;
 }
 
+static int add_ref_state(const struct reference *ref, void *cb_data)
+{
+	strbuf_addf(cb_data, "%s %s\n", oid_to_hex(ref->oid), ref->name);
+	return 0;
+}
+
+/* Identify the current refs of the repository, without reading objects. */
+void cgit_get_ref_state(struct object_id *oid)
+{
+	struct strbuf state = STRBUF_INIT;
+
+	refs_for_each_ref(get_main_ref_store(the_repository),
+			  add_ref_state, &state);
+	hash_object_file(the_hash_algo, state.buf, state.len, OBJ_BLOB, oid);
+	strbuf_release(&state);
+}
+
 void cgit_diff_tree_cb(struct diff_queue_struct *q,
 		       struct diff_options *options, void *data)
 {
@@ -338,6 +363,295 @@ int cgit_diff_files(const struct object_id *old_oid,
 	return 0;
 }
 
+/*
+ * Rename detection is by far the most expensive part of a tree diff when
+ * lots of files are added and removed. The rename pairs found for a given
+ * (old tree, new tree, renamelimit, prefix) never change, so they may be
+ * stored in the "renames" directory below cache-root, and the search can
+ * be bounded in time by running it in a child process which is abandoned
+ * when `rename-budget` milliseconds have passed.
+ *
+ * Rename pairs are serialized as the rename limit git asked for (if it was
+ * exceeded) followed by "<score> <src>\0<dst>\0" for each pair.
+ */
+static const char *rename_warning;
+static int rename_budget_exceeded;
+static struct strbuf rename_memo_key = STRBUF_INIT;
+static struct strbuf rename_memo = STRBUF_INIT;
+
+const char *cgit_diff_rename_warning(void)
+{
+	return rename_warning;
+}
+
+int cgit_diff_rename_budget_exceeded(void)
+{
+	return rename_budget_exceeded;
+}
+
+static char *rename_cache_path(void)
+{
+	return fmt("%s/renames", ctx.cfg.cache_root);
+}
+
+static int has_rename_candidates(struct diff_queue_struct *q)
+{
+	int i, added = 0, deleted = 0;
+
+	for (i = 0; i < q->nr; i++) {
+		struct diff_filepair *p = q->queue[i];
+
+		if (!DIFF_FILE_VALID(p->one) && DIFF_FILE_VALID(p->two))
+			added++;
+		else if (DIFF_FILE_VALID(p->one) && !DIFF_FILE_VALID(p->two))
+			deleted++;
+	}
+	return added && deleted;
+}
+
+/* Run git's rename detection on the queued diff and serialize the result. */
+static void find_renames(struct diff_options *opt, struct strbuf *pairs)
+{
+	struct diff_queue_struct *q = &diff_queued_diff;
+	int i;
+
+	opt->detect_rename = DIFF_DETECT_RENAME;
+	diffcore_rename(opt);
+	opt->detect_rename = 0;
+
+	strbuf_addf(pairs, "%d", opt->needed_rename_limit);
+	strbuf_addch(pairs, '\0');
+	for (i = 0; i < q->nr; i++) {
+		struct diff_filepair *p = q->queue[i];
+
+		if (!p->renamed_pair)
+			continue;
+		strbuf_addf(pairs, "%d %s", p->score, p->one->path);
+		strbuf_addch(pairs, '\0');
+		strbuf_addstr(pairs, p->two->path);
+		strbuf_addch(pairs, '\0');
+	}
+}
+
+/* Read from `fd` until EOF, but give up after `timeout` milliseconds. */
+static int read_with_deadline(int fd, struct strbuf *buf, int timeout)
+{
+	struct pollfd pfd = { .fd = fd, .events = POLLIN };
+	struct timeval start, now;
+	long elapsed;
+	ssize_t len;
+
+	gettimeofday(&start, NULL);
+	while (1) {
+		gettimeofday(&now, NULL);
+		elapsed = (now.tv_sec - start.tv_sec) * 1000 +
+			  (now.tv_usec - start.tv_usec) / 1000;
+		if (elapsed >= timeout)
+			return ETIMEDOUT;
+		if (poll(&pfd, 1, timeout - elapsed) < 0) {
+			if (errno == EINTR)
+				continue;
+			return errno;
+		}
+		if (!pfd.revents)
+			continue;
+		len = strbuf_read_once(buf, fd, 0);
+		if (len < 0) {
+			if (errno == EINTR || errno == EAGAIN)
+				continue;
+			return errno;
+		}
+		if (!len)
+			return 0;
+	}
+}
+
+/* Search for renames, either directly or within the rename budget.
+ * Returns 0 when `pairs` holds the result (which still needs to be applied
+ * to the queued diff), 1 when the renames have been applied by git itself
+ * and -1 when the budget was exhausted.
+ */
+static int compute_renames(struct diff_options *opt, const char *key,
+			   struct strbuf *pairs)
+{
+	int fd[2];
+	pid_t pid;
+
+	if (ctx.cfg.rename_budget <= 0 || pipe(fd)) {
+		find_renames(opt, pairs);
+		if (ctx.cfg.enable_rename_cache)
+			cache_put(ctx.cfg.cache_size, rename_cache_path(), key,
+				  pairs->buf, pairs->len);
+		return 1;
+	}
+
+	fflush(NULL);
+	pid = fork();
+	if (pid < 0) {
+		close(fd[0]);
+		close(fd[1]);
+		find_renames(opt, pairs);
+		return 1;
+	}
+	if (!pid) {
+		close(fd[0]);
+		cache_detach();
+		signal(SIGPIPE, SIG_IGN);
+		find_renames(opt, pairs);
+		if (ctx.cfg.enable_rename_cache)
+			cache_put(ctx.cfg.cache_size, rename_cache_path(), key,
+				  pairs->buf, pairs->len);
+		write_in_full(fd[1], pairs->buf, pairs->len);
+		_exit(0);
+	}
+
+	close(fd[1]);
+	if (!read_with_deadline(fd[0], pairs, ctx.cfg.rename_budget)) {
+		close(fd[0]);
+		waitpid(pid, NULL, 0);
+		return 0;
+	}
+	close(fd[0]);
+
+	/* Out of time. When the result can be cached, the child is left to
+	 * finish in the background so that the next request for this diff
+	 * gets the complete rename information.
+	 */
+	if (!ctx.cfg.enable_rename_cache || ctx.cfg.cache_size <= 0) {
+		kill(pid, SIGKILL);
+		waitpid(pid, NULL, 0);
+	}
+	strbuf_reset(pairs);
+	return -1;
+}
+
+/* Turn the creation/deletion pairs named in `pairs` into renames, just
+ * like diffcore_rename() would have done.
+ */
+static void apply_renames(struct diff_options *opt, const struct strbuf *pairs)
+{
+	struct diff_queue_struct *q = &diff_queued_diff;
+	struct diff_queue_struct outq = DIFF_QUEUE_INIT;
+	struct string_list sources = STRING_LIST_INIT_NODUP;
+	struct string_list renames = STRING_LIST_INIT_NODUP;
+	struct string_list_item *item, *src;
+	const char *p, *end = pairs->buf + pairs->len;
+	char *path;
+	int i;
+
+	if (!pairs->len)
+		return;
+	opt->needed_rename_limit = atoi(pairs->buf);
+	for (p = pairs->buf + strlen(pairs->buf) + 1; p < end; ) {
+		const char *dst;
+
+		path = strchr(p, ' ');
+		if (!path)
+			break;
+		dst = path + strlen(path) + 1;
+		if (dst >= end)
+			break;
+		string_list_append(&renames, dst)->util = (void *)p;
+		p = dst + strlen(dst) + 1;
+	}
+	if (!renames.nr)
+		return;
+
+	for (i = 0; i < q->nr; i++) {
+		struct diff_filepair *pair = q->queue[i];
+
+		if (DIFF_FILE_VALID(pair->one) && !DIFF_FILE_VALID(pair->two))
+			string_list_append(&sources, pair->one->path)->util = pair;
+	}
+	string_list_sort(&sources);
+	string_list_sort(&renames);
+
+	for (i = 0; i < q->nr; i++) {
+		struct diff_filepair *pair = q->queue[i];
+		struct diff_filepair *src_pair;
+
+		if (DIFF_FILE_VALID(pair->one) || !DIFF_FILE_VALID(pair->two))
+			continue;
+		item = string_list_lookup(&renames, pair->two->path);
+		if (!item)
+			continue;
+		src = string_list_lookup(&sources, strchr(item->util, ' ') + 1);
+		if (!src)
+			continue;
+		src_pair = src->util;
+		if (src_pair->one->rename_used)
+			continue;
+		src_pair->one->rename_used++;
+		src_pair->one->count++;
+		free_filespec(pair->one);
+		pair->one = src_pair->one;
+		pair->renamed_pair = 1;
+		pair->score = atoi(item->util);
+	}
+
+	/* Drop the deletions which have been turned into renames. */
+	for (i = 0; i < q->nr; i++) {
+		struct diff_filepair *pair = q->queue[i];
+
+		if (DIFF_FILE_VALID(pair->one) && !DIFF_FILE_VALID(pair->two) &&
+		    pair->one->rename_used)
+			diff_free_filepair(pair);
+		else
+			diff_q(&outq, pair);
+	}
+	free(q->queue);
+	*q = outq;
+
+	string_list_clear(&sources, 0);
+	string_list_clear(&renames, 0);
+}
+
+static void detect_renames(struct diff_options *opt,
+			   const struct object_id *old_oid,
+			   const struct object_id *new_oid, const char *prefix)
+{
+	struct strbuf key = STRBUF_INIT;
+	struct strbuf pairs = STRBUF_INIT;
+	struct tree *old_tree, *new_tree;
+	int status = 0;
+
+	opt->detect_rename = 0;
+	if (!has_rename_candidates(&diff_queued_diff))
+		return;
+
+	old_tree = parse_tree_indirect(old_oid);
+	new_tree = parse_tree_indirect(new_oid);
+	if (!old_tree || !new_tree) {
+		opt->detect_rename = DIFF_DETECT_RENAME;
+		return;
+	}
+	strbuf_addf(&key, "%s..%s %d %s", oid_to_hex(&old_tree->object.oid),
+		    oid_to_hex(&new_tree->object.oid), ctx.cfg.renamelimit,
+		    prefix ? prefix : "");
+
+	if (!strcmp(key.buf, rename_memo_key.buf))
+		strbuf_addbuf(&pairs, &rename_memo);
+	else if (!ctx.cfg.enable_rename_cache ||
+		 cache_get(ctx.cfg.cache_size, rename_cache_path(), key.buf, -1,
+			   &pairs))
+		status = compute_renames(opt, key.buf, &pairs);
+
+	if (status < 0) {
+		rename_budget_exceeded = 1;
+		rename_warning = "Rename detection exceeded its time budget; "
+				 "renamed files are shown as added and deleted.";
+	} else if (!status)
+		apply_renames(opt, &pairs);
+
+	/* The diff page asks for the same diff twice (diffstat + diff). */
+	if (status >= 0) {
+		strbuf_swap(&rename_memo_key, &key);
+		strbuf_swap(&rename_memo, &pairs);
+	}
+	strbuf_release(&key);
+	strbuf_release(&pairs);
+}
+
 void cgit_diff_tree(const struct object_id *old_oid,
 		    const struct object_id *new_oid,
 		    filepair_fn fn, const char *prefix, int ignorews)
@@ -363,11 +677,16 @@ void cgit_diff_tree(const struct object_id *old_oid,
 	}
 	diff_setup_done(&opt);
 
-	if (old_oid && !is_null_oid(old_oid))
+	if (old_oid && !is_null_oid(old_oid)) {
 		diff_tree_oid(old_oid, new_oid, "", &opt);
-	else
+		if (ctx.cfg.rename_budget > 0 || ctx.cfg.enable_rename_cache)
+			detect_renames(&opt, old_oid, new_oid, prefix);
+	} else
 		diff_root_tree_oid(new_oid, "", &opt);
 	diffcore_std(&opt);
+	if (opt.needed_rename_limit && !rename_warning)
+		rename_warning = "Too many files for inexact rename detection; "
+				 "see the renamelimit setting.";
 	diff_flush(&opt);
 }
 
@@ -381,6 +700,101 @@ void cgit_diff_commit(struct commit *commit, filepair_fn fn, const char *prefix)
 		       ctx.qry.ignorews);
 }
 
+/*
+ * Use the changed-path Bloom filters in the commit-graph to check whether
+ * `commit` may have changed `path` relative to its first parent. Returns
+ * 0 only if the commit is known not to touch the path.
+ */
+int cgit_commit_may_change_path(struct commit *commit, const char *path)
+{
+	static struct bloom_filter_settings *settings;
+	static int initialized;
+	static struct bloom_key key;
+	static char *key_path;
+	struct bloom_filter *filter;
+
+	if (!initialized) {
+		settings = get_bloom_filter_settings(the_repository);
+		initialized = 1;
+	}
+	if (!settings || !path || !*path)
+		return 1;
+	filter = get_bloom_filter(the_repository, commit);
+	if (!filter)
+		return 1;
+	if (!key_path || strcmp(key_path, path)) {
+		if (key_path)
+			bloom_key_clear(&key);
+		free(key_path);
+		key_path = xstrdup(path);
+		bloom_key_fill(&key, key_path, strlen(key_path), settings);
+	}
+	return bloom_filter_contains(filter, &key, settings) != 0;
+}
+
+/*
+ * Path-limited revision walks use the changed-path Bloom filters of the
+ * commit-graph on their own. If the repository has none, or its graph
+ * does not cover `tip` yet, let "git commit-graph write" add them in the
+ * background so that later requests can skip the tree diffs.
+ */
+void cgit_update_bloom_filters(const char *tip)
+{
+	struct child_process cmd = CHILD_PROCESS_INIT;
+	struct object_id oid;
+	struct commit *commit;
+	char *lock;
+	pid_t pid;
+
+	if (!ctx.repo || !ctx.repo->enable_bloom_filters)
+		return;
+
+	if (get_bloom_filter_settings(the_repository)) {
+		if (!tip || repo_get_oid(the_repository, tip, &oid))
+			return;
+		commit = lookup_commit_reference(the_repository, &oid);
+		if (!commit || repo_parse_commit(the_repository, commit) ||
+		    commit_graph_position(commit) != COMMIT_NOT_FROM_GRAPH)
+			return;
+	}
+
+	/* Somebody is already writing it. */
+	lock = repo_git_path(the_repository,
+			     "objects/info/commit-graphs/commit-graph-chain.lock");
+	if (!access(lock, F_OK)) {
+		free(lock);
+		return;
+	}
+	free(lock);
+
+	cmd.git_cmd = 1;
+	cmd.no_stdin = 1;
+	cmd.no_stdout = 1;
+	cmd.no_stderr = 1;
+	strvec_pushl(&cmd.args, "commit-graph", "write", "--reachable",
+		     "--changed-paths", "--split", NULL);
+
+	/* Start the write from an intermediate child which exits right away,
+	 * so that the write is not ours to wait for.
+	 */
+	fflush(NULL);
+	pid = fork();
+	if (pid < 0) {
+		child_process_clear(&cmd);
+		return;
+	}
+	if (!pid) {
+		if (start_command(&cmd)) {
+			fprintf(stderr, "[cgit] Failed to start commit-graph write for %s\n",
+				ctx.repo->path);
+			_exit(1);
+		}
+		_exit(0);
+	}
+	child_process_clear(&cmd);
+	waitpid(pid, NULL, 0);
+}
+
 int cgit_parse_snapshots_mask(const char *str)
 {
 	struct string_list tokens = STRING_LIST_INIT_DUP;
@@ -467,6 +881,70 @@ int readfile(const char *path, char **buf, size_t *size)
 	return (*size == st.st_size ? 0 : e);
 }
 
+static time_t read_agefile(const char *path)
+{
+	time_t result;
+	size_t size;
+	char *buf = NULL;
+	struct strbuf date_buf = STRBUF_INIT;
+
+	if (readfile(path, &buf, &size)) {
+		free(buf);
+		return 0;
+	}
+
+	if (parse_date(buf, &date_buf) == 0)
+		result = strtoul(date_buf.buf, NULL, 10);
+	else
+		result = 0;
+	free(buf);
+	strbuf_release(&date_buf);
+	return result;
+}
+
+int cgit_get_repo_modtime(const struct cgit_repo *repo, time_t *mtime)
+{
+	struct strbuf path = STRBUF_INIT;
+	struct stat s;
+	struct cgit_repo *r = (struct cgit_repo *)repo;
+
+	if (repo->mtime != -1) {
+		*mtime = repo->mtime;
+		return 1;
+	}
+	strbuf_addf(&path, "%s/%s", repo->path, ctx.cfg.agefile);
+	if (stat(path.buf, &s) == 0) {
+		*mtime = read_agefile(path.buf);
+		if (*mtime) {
+			r->mtime = *mtime;
+			goto end;
+		}
+	}
+
+	strbuf_reset(&path);
+	strbuf_addf(&path, "%s/refs/heads/%s", repo->path,
+		    repo->defbranch ? repo->defbranch : "master");
+	if (stat(path.buf, &s) == 0) {
+		*mtime = s.st_mtime;
+		r->mtime = *mtime;
+		goto end;
+	}
+
+	strbuf_reset(&path);
+	strbuf_addf(&path, "%s/%s", repo->path, "packed-refs");
+	if (stat(path.buf, &s) == 0) {
+		*mtime = s.st_mtime;
+		r->mtime = *mtime;
+		goto end;
+	}
+
+	*mtime = 0;
+	r->mtime = *mtime;
+end:
+	strbuf_release(&path);
+	return (r->mtime != 0);
+}
+
 static int is_token_char(char c)
 {
 	return isalnum(c) || c == '_';
@@ -7,6 +7,8 @@
 # Helper functions
 #   cgit_query(querystring) - call cgit with the specified querystring
 #   cgit_url(url) - call cgit with the specified virtual url
+#   cgit_url_with(option, url) - same with an option prepended to cgitrc,
+#	leaving out the headers and the footer with the current time
 #
 # Example script:
 #
@@ -169,6 +171,16 @@ cgit_url()
 	CGIT_CONFIG="$PWD/cgitrc" QUERY_STRING="url=$1" cgit
 }
 
+cgit_url_with()
+{
+	{
+		printf "%s\n" "$1" cache-dynamic-ttl=0 cache-repo-ttl=0 &&
+		cat cgitrc
+	} >cgitrc-with &&
+	CGIT_CONFIG="$PWD/cgitrc-with" QUERY_STRING="url=$2" cgit |
+	strip_headers | grep -v "generated by"
+}
+
 strip_headers() {
 	while read -r line
 	do
@@ -14,4 +14,165 @@ test_expect_success 'verify "with%20space" link' 'grep "/with%20space/" tmp'
 test_expect_success 'no tree-link' '! grep "foo/tree" tmp'
 test_expect_success 'no log-link' '! grep "foo/log" tmp'
 
+test_expect_success 'generate first page sorted by name' '
+	cgit_url_with max-repo-count=2 "&s=name" >tmp
+'
+test_expect_success 'find two repos' 'test $(grep -c "toplevel-repo" tmp) = 2'
+test_expect_success 'find bar repo first' 'grep "toplevel-repo.*/bar/" tmp'
+test_expect_success 'no with space repo' '! grep "/with%20space/" tmp'
+test_expect_success 'find pager' 'grep "s=name&amp;ofs=2" tmp'
+
+test_expect_success 'pages hold all repos' '
+	for ofs in 0 2 4 6
+	do
+		cgit_url_with max-repo-count=2 "&s=name&ofs=$ofs" || return 1
+	done >tmp &&
+	test $(grep -c "toplevel-repo" tmp) = $(grep -c "^repo.url=" cgitrc)
+'
+
+test_expect_success 'generate repolist_json' 'cgit_query "p=repolist_json" >tmp'
+test_expect_success 'check content type' '
+	grep "^Content-Type: application/x-ndjson" tmp
+'
+test_expect_success 'find one line per repo' '
+	strip_headers <tmp >actual &&
+	test_line_count = $(grep -c "^repo.url=" cgitrc) actual
+'
+test_expect_success 'find bar repo' '
+	grep "^{\"url\":\"bar\",\"name\":\"bar\",\"desc\":\"the bar repo\"," actual
+'
+test_expect_success 'find modification time' 'grep "\"modified\":[0-9]*}$" actual'
+
+test_expect_success 'search repolist_json' '
+	cgit_query "p=repolist_json&q=bar" | strip_headers >actual &&
+	test_line_count = 2 actual
+'
+test_expect_success 'page through repolist_json' '
+	cgit_url_with max-repo-count=2 "&p=repolist_json&s=name&ofs=2" |
+	strip_headers >actual &&
+	test_line_count = 2 actual &&
+	! grep "\"url\":\"bar\"" actual
+'
+test_expect_success 'repolist_json shows the owner only on the index' '
+	grep "\"owner\":" actual &&
+	cgit_url_with enable-index-owner=0 "&p=repolist_json" >actual &&
+	! grep "\"owner\":" actual
+'
+test_expect_success 'repolist_json replaces invalid UTF-8' '
+	{
+		cat cgitrc &&
+		echo "repo.url=latin1" &&
+		echo "repo.path=$PWD/repos/foo/.git" &&
+		printf "repo.desc=caf\351 \303\251\n"
+	} >cgitrc-json &&
+	CGIT_CONFIG="$PWD/cgitrc-json" QUERY_STRING="p=repolist_json&q=latin1" cgit |
+	strip_headers >actual &&
+	grep -F "\"desc\":\"caf\\ufffd $(printf "\303\251")\"" actual
+'
+
+# Search a scanned repolist, which is indexed when it is cached.
+cgit_search()
+{
+	CGIT_CONFIG="$PWD/cgitrc-scan" QUERY_STRING="q=$1" cgit |
+	strip_headers
+}
+
+test_expect_success 'setup scanned repolist' '
+	cat >cgitrc-scan <<-EOF
+	virtual-root=/
+	cache-root=$PWD/cache
+	cache-size=1021
+	cache-dynamic-ttl=0
+	cache-repo-ttl=0
+	scan-path=$PWD/repos
+	EOF
+'
+test_expect_success 'search uncached repolist' 'cgit_search BAR >tmp'
+test_expect_success 'repolist is indexed' 'ls cache/rc-*.idx'
+test_expect_success 'find bar repo' 'grep "/bar/" tmp'
+test_expect_success 'find foo+bar repo' 'grep "/foo+bar/" tmp'
+test_expect_success 'no foo repo' '! grep "/foo/" tmp'
+
+test_expect_success 'search indexed repolist' 'cgit_search BAR >actual'
+test_expect_success 'same results' 'test_cmp tmp actual'
+test_expect_success 'search indexed repolist for a short query' '
+	cgit_search fo >tmp &&
+	grep "/foo/" tmp &&
+	grep "/foo+bar/" tmp &&
+	! grep "/bar/" tmp
+'
+test_expect_success 'search indexed repolist without match' '
+	cgit_search xyzzy >tmp &&
+	grep "No repositories found" tmp
+'
+
+test_expect_success 'repolist has idle table' 'ls cache/rc-*.idle'
+test_expect_success 'repolist has sort orders' 'ls cache/rc-*.sort'
+
+test_expect_success 'sort scanned repolist by name' '
+	CGIT_CONFIG="$PWD/cgitrc-scan" QUERY_STRING="s=name" cgit >tmp &&
+	grep -o "toplevel-repo.><a [^>]*>" tmp >actual &&
+	sed -e "s/^cache-size=.*/cache-size=0/" cgitrc-scan >cgitrc-noscan &&
+	CGIT_CONFIG="$PWD/cgitrc-noscan" QUERY_STRING="s=name" cgit >tmp &&
+	grep -o "toplevel-repo.><a [^>]*>" tmp >expect &&
+	test_line_count = 5 expect &&
+	test_cmp expect actual
+'
+test_expect_success 'set old agefile for foo' '
+	mkdir -p repos/foo/.git/info/web &&
+	echo "2000-01-01 00:00:00" >repos/foo/.git/info/web/last-modified
+'
+test_expect_success 'idle time is read from the table' '
+	cgit_search "foo&s=idle" >tmp &&
+	! grep "age-years" tmp
+'
+test_expect_success 'update idle times' '
+	CGIT_CONFIG="$PWD/cgitrc-scan" cgit --update-idle-times
+'
+test_expect_success 'idle time is updated' '
+	cgit_search "foo&s=idle" >tmp &&
+	grep "age-years" tmp
+'
+test_expect_success 'idle table is ignored for a later agefile' '
+	{
+		cat cgitrc-scan &&
+		echo "agefile=info/web/none"
+	} >cgitrc-agefile &&
+	CGIT_CONFIG="$PWD/cgitrc-agefile" QUERY_STRING="q=foo&s=idle" cgit |
+	strip_headers >tmp &&
+	grep "/foo/" tmp &&
+	! grep "age-years" tmp
+'
+
+test_expect_success 'setup scanned repolist with a hidden repo' '
+	git -C repos/bar config cgit.hide 1 &&
+	cat >cgitrc-hide <<-EOF &&
+	virtual-root=/
+	cache-root=$PWD/cache-hide
+	cache-size=1021
+	cache-dynamic-ttl=0
+	cache-repo-ttl=0
+	max-repo-count=2
+	enable-git-config=1
+	scan-path=$PWD/repos
+	EOF
+	sed -e "s/^cache-size=.*/cache-size=0/" cgitrc-hide >cgitrc-hide-nocache &&
+	mkdir cache-hide &&
+	CGIT_CONFIG="$PWD/cgitrc-hide" QUERY_STRING="" cgit >/dev/null &&
+	ls cache-hide/rc-*.sort
+'
+
+test_expect_success 'pages from the sort orders leave out the hidden repo' '
+	test_when_finished "git -C repos/bar config --unset cgit.hide" &&
+	for query in "" "ofs=2" "s=name" "s=name&ofs=2" "s=idle&ofs=2"
+	do
+		CGIT_CONFIG="$PWD/cgitrc-hide" QUERY_STRING="$query" cgit |
+		strip_headers | grep -v "generated by" >actual &&
+		CGIT_CONFIG="$PWD/cgitrc-hide-nocache" QUERY_STRING="$query" cgit |
+		strip_headers | grep -v "generated by" >expect &&
+		test_cmp expect actual &&
+		! grep "/bar/" actual || return 1
+	done
+'
+
 test_done
@@ -22,4 +22,59 @@ test_expect_success 'clone-url expanded correctly' '
 	grep "git://example.org/bar.git" tmp
 '
 
+test_expect_success 'setup branches and tags of different ages' '
+	tree=$(git -C repos/bar rev-parse HEAD^{tree}) &&
+	for n in 1 2 3 4 5 6 7
+	do
+		date="@$((1700000000 + $n * 60)) +0000" &&
+		oid=$(GIT_COMMITTER_DATE="$date" \
+		      git -C repos/bar commit-tree -m "branch $n" $tree) &&
+		git -C repos/bar branch branch-$n $oid &&
+		GIT_COMMITTER_DATE="$date" \
+		git -C repos/bar tag -m "tag $n" tag-$n $oid || return 1
+	done &&
+	git -C repos/bar commit-graph write --reachable
+'
+
+test_expect_success 'generate bar summary with refs' 'cgit_url "bar" >tmp'
+test_expect_success 'find the newest branches' '
+	for n in 3 4 5 6 7
+	do
+		grep ">branch-$n</a>" tmp || return 1
+	done
+'
+test_expect_success 'no older branches' '
+	! grep ">branch-1</a>" tmp &&
+	! grep ">branch-2</a>" tmp
+'
+test_expect_success 'find the newest tags' '
+	for n in 3 4 5 6 7
+	do
+		grep ">tag-$n</a>" tmp || return 1
+	done
+'
+test_expect_success 'no older tags' '
+	! grep ">tag-1</a>" tmp &&
+	! grep ">tag-2</a>" tmp
+'
+test_expect_success 'tags ordered by age' '
+	grep -o ">tag-[0-9]</a>" tmp >actual &&
+	printf ">tag-%d</a>\n" 7 6 5 4 3 >expect &&
+	test_cmp expect actual
+'
+test_expect_success 'find links to all refs' '
+	grep "/bar/refs/heads" tmp &&
+	grep "/bar/refs/tags" tmp
+'
+
+test_expect_success 'generate bar refs' 'cgit_url "bar/refs" >tmp'
+test_expect_success 'find all branches and tags' '
+	for n in 1 2 3 4 5 6 7
+	do
+		grep ">branch-$n</a>" tmp &&
+		grep ">tag-$n</a>" tmp || return 1
+	done &&
+	grep ">master</a>" tmp
+'
+
 test_done
@@ -21,4 +21,25 @@ test_expect_success 'no links with space in path' '! grep "href=./with space/" t
 test_expect_success 'no links with space in arg' '! grep "q=commit 1" tmp'
 test_expect_success 'commit 2 is not visible' '! grep "commit 2" tmp'
 
+test_expect_success 'rename a file with history' '
+	echo changed >repos/foo/file-1 &&
+	git -C repos/foo commit -a -m "change file-1" &&
+	git -C repos/foo mv file-1 moved-1 &&
+	git -C repos/foo commit -m "move file-1" &&
+	echo changed again >repos/foo/moved-1 &&
+	git -C repos/foo commit -a -m "change moved-1" &&
+	git -C repos/foo commit-graph write --reachable --changed-paths
+'
+test_expect_success 'generate foo/log following the renamed file' '
+	cgit_url_with enable-follow-links=1 "foo/log/moved-1&follow=1" >tmp
+'
+test_expect_success 'find commits after the rename' '
+	grep ">change moved-1</a>" tmp &&
+	grep ">move file-1</a>" tmp
+'
+test_expect_success 'find commit before the rename' '
+	grep ">change file-1</a>" tmp
+'
+test_expect_success 'no commits of other files' '! grep ">commit 2</a>" tmp'
+
 test_done
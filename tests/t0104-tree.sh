@@ -6,6 +6,7 @@ test_description='Check content on tree page'
 test_expect_success 'generate bar/tree' 'cgit_url "bar/tree" >tmp'
 test_expect_success 'find file-1' 'grep "file-1" tmp'
 test_expect_success 'find file-50' 'grep "file-50" tmp'
+test_expect_success 'find sizes' 'grep "ls-size" tmp'
 
 test_expect_success 'generate bar/tree/file-50' 'cgit_url "bar/tree/file-50" >tmp'
 
@@ -25,8 +26,43 @@ test_expect_success 'verify a+b link' '
 
 test_expect_success 'generate foo+bar/tree?h=1+2' 'cgit_url "foo%2bbar/tree&h=1%2b2" >tmp'
 
-test_expect_success 'verify a+b?h=1+2 link' '
-	grep "/foo+bar/tree/a+b?h=1%2b2" tmp
+test_expect_success 'verify a+b link on branch 1+2' '
+	grep "/foo+bar/tree/a+b?id=[0-9a-f]\{40,64\}" tmp &&
+	grep "/foo+bar/log/?h=1%2b2" tmp
+'
+
+test_expect_success 'generate bar/tree without sizes' '
+	cgit_url_with enable-tree-sizes=0 "bar/tree" >tmp
+'
+test_expect_success 'find file-50' 'grep "file-50" tmp'
+test_expect_success 'no sizes' '! grep "ls-size" tmp'
+
+test_expect_success 'generate bar/tree without fragment cache' '
+	cgit_url_with enable-fragment-cache=0 "bar/tree" >expect
+'
+test_expect_success 'generate bar/tree with cold fragment cache' '
+	cgit_url_with enable-fragment-cache=1 "bar/tree" >actual &&
+	test_cmp expect actual
+'
+test_expect_success 'tree listing is cached' 'test -d cache/fragments'
+test_expect_success 'generate bar/tree with warm fragment cache' '
+	cgit_url_with enable-fragment-cache=1 "bar/tree" >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'generate bar/tree with last commits' '
+	cgit_url_with enable-tree-last-commit=1 "bar/tree" >expect
+'
+test_expect_success 'find last commit of file-7' '
+	grep "file-7<.*>commit 7<" expect
+'
+test_expect_success 'find last commit of file-50' '
+	grep "file-50<.*>commit 50<" expect
+'
+test_expect_success 'last commits are cached' 'test -d cache/tree-commits'
+test_expect_success 'generate bar/tree with cached last commits' '
+	cgit_url_with enable-tree-last-commit=1 "bar/tree" >actual &&
+	test_cmp expect actual
 '
 
 test_done
@@ -16,4 +16,121 @@ test_expect_success 'find added line' '
 	grep "<div class=.add.>+5</div>" tmp
 '
 
+test_expect_success 'generate foo/diff without fragment cache' '
+	cgit_url_with enable-fragment-cache=0 "foo/diff" >expect
+'
+test_expect_success 'generate foo/diff with cold fragment cache' '
+	cgit_url_with enable-fragment-cache=1 "foo/diff" >actual &&
+	test_cmp expect actual
+'
+test_expect_success 'diff is cached' 'test -d cache/fragments'
+test_expect_success 'generate foo/diff with warm fragment cache' '
+	cgit_url_with enable-fragment-cache=1 "foo/diff" >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'generate foo/diff in ssdiff mode' '
+	cgit_url_with enable-fragment-cache=0 "foo/diff&dt=1" >expect &&
+	cgit_url_with enable-fragment-cache=1 "foo/diff&dt=1" >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'rename a file' '
+	git -C repos/foo mv file-1 moved-1 &&
+	git -C repos/foo commit -m "move file-1"
+'
+test_expect_success 'generate foo/diff with rename cache' '
+	cgit_url_with enable-rename-cache=1 "foo/diff" >tmp &&
+	grep "(renamed from file-1)" tmp
+'
+test_expect_success 'renames are cached' '
+	test -n "$(ls cache/renames)"
+'
+test_expect_success 'generate foo/diff from rename cache' '
+	cgit_url_with enable-rename-cache=1 "foo/diff" >actual &&
+	test_cmp tmp actual
+'
+test_expect_success 'generate foo/diff within rename budget' '
+	cgit_url_with rename-budget=60000 "foo/diff" >actual &&
+	test_cmp tmp actual &&
+	! grep "diffstat-warning" actual
+'
+
+# Moving and changing 300 files at once takes the inexact rename search
+# well beyond a millisecond.
+test_expect_success 'setup repo with many renames' '
+	test_create_repo repos/renames &&
+	(
+		cd repos/renames &&
+		awk "BEGIN {
+			for (i = 0; i < 300; i++) {
+				f = \"old-\" i;
+				for (j = 0; j < 50; j++)
+					print \"file\", i, \"line\", j >f;
+				close(f);
+			}
+		}" &&
+		git add . &&
+		git commit -m "add files" &&
+		awk "BEGIN {
+			for (i = 0; i < 300; i++) {
+				f = \"new-\" i;
+				for (j = 0; j < 50; j++)
+					print \"file\", i, j ? \"line\" : \"changed\", j >f;
+				close(f);
+			}
+		}" &&
+		git rm -q old-* &&
+		git add . &&
+		git commit -m "move files"
+	) &&
+	cat >>cgitrc <<-EOF
+	repo.url=renames
+	repo.path=$PWD/repos/renames/.git
+	EOF
+'
+test_expect_success 'generate renames/diff without budget' '
+	cgit_url_with rename-budget=0 "renames/diff" >expect &&
+	grep "(renamed from old-0)" expect
+'
+test_expect_success 'generate renames/diff beyond rename budget' '
+	{
+		echo rename-budget=1 &&
+		echo enable-rename-cache=1 &&
+		echo cache-dynamic-ttl=0 &&
+		echo cache-repo-ttl=0 &&
+		cat cgitrc
+	} >cgitrc-budget &&
+	CGIT_CONFIG="$PWD/cgitrc-budget" QUERY_STRING="url=renames/diff" cgit |
+	strip_headers >tmp &&
+	grep "diffstat-warning" tmp &&
+	grep "new-0" tmp &&
+	! grep "renamed from" tmp
+'
+test_expect_success 'renames/diff shows renames found in the background' '
+	for i in $(test_seq 60)
+	do
+		CGIT_CONFIG="$PWD/cgitrc-budget" QUERY_STRING="url=renames/diff" cgit |
+		strip_headers | grep -v "generated by" >actual &&
+		! grep "diffstat-warning" actual && break
+		sleep 1
+	done &&
+	test_cmp expect actual
+'
+
+test_expect_success 'diff beyond the renamelimit is cached' '
+	{
+		echo renamelimit=1 &&
+		echo enable-fragment-cache=1 &&
+		echo cache-dynamic-ttl=0 &&
+		echo cache-repo-ttl=0 &&
+		cat cgitrc
+	} >cgitrc-limit &&
+	rm -rf cache/fragments &&
+	CGIT_CONFIG="$PWD/cgitrc-limit" QUERY_STRING="url=renames/diff" cgit |
+	strip_headers >tmp &&
+	grep "see the renamelimit setting" tmp &&
+	test -n "$(ls cache/fragments)"
+'
+
 test_done
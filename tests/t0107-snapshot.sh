@@ -202,4 +202,126 @@ test_expect_success UNZIP 'verify unzipped file-5' '
 	test_line_count = 1 master/file-5
 '
 
+test_expect_success 'setup snapshot store' '
+	cp cgitrc cgitrc-store &&
+	cat >>cgitrc-store <<-EOF
+	snapshot-cache-size=1
+	cache-snapshot-ttl=0
+	EOF
+'
+
+test_expect_success 'get foo/snapshot/master.tar.gz without store' '
+	cgit_url "foo/snapshot/master.tar.gz" | strip_headers >expect
+'
+
+test_expect_success 'get foo/snapshot/master.tar.gz from cold store' '
+	CGIT_CONFIG="$PWD/cgitrc-store" QUERY_STRING="url=foo/snapshot/master.tar.gz" cgit |
+	strip_headers >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'snapshot is stored' '
+	ls cache/snapshots >output &&
+	test_line_count = 1 output
+'
+
+test_expect_success 'get foo/snapshot/master.tar.gz from warm store' '
+	CGIT_CONFIG="$PWD/cgitrc-store" QUERY_STRING="url=foo/snapshot/master.tar.gz" cgit |
+	strip_headers >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'serving a stored snapshot leaves the store alone' '
+	dd if=/dev/zero of=cache/snapshots/old bs=1024 count=2048 &&
+	touch -t 200001010000 cache/snapshots/old &&
+	CGIT_CONFIG="$PWD/cgitrc-store" QUERY_STRING="url=foo/snapshot/master.tar.gz" cgit |
+	strip_headers >actual &&
+	test_cmp expect actual &&
+	test -f cache/snapshots/old
+'
+
+test_expect_success 'storing a snapshot trims the store' '
+	CGIT_CONFIG="$PWD/cgitrc-store" QUERY_STRING="url=foo/snapshot/master.zip" cgit >/dev/null &&
+	! test -f cache/snapshots/old &&
+	ls cache/snapshots >output &&
+	test_line_count = 2 output
+'
+
+test_expect_success 'setup repo with a large file' '
+	test_create_repo repos/large &&
+	(
+		cd repos/large &&
+		awk "BEGIN { for (i = 0; i < 200000; i++) print i }" >numbers &&
+		git add numbers &&
+		git commit -m "add numbers"
+	) &&
+	cp cgitrc cgitrc-threads &&
+	cat >>cgitrc-threads <<-EOF
+	snapshot-threads=4
+
+	repo.url=large
+	repo.path=$PWD/repos/large/.git
+	EOF
+'
+
+test_expect_success 'get large/snapshot/master.tar.gz with threads' '
+	CGIT_CONFIG="$PWD/cgitrc-threads" QUERY_STRING="url=large/snapshot/master.tar.gz" cgit |
+	strip_headers >large.tar.gz
+'
+
+test_expect_success 'verify gzip format' 'gunzip --test large.tar.gz'
+
+test_expect_success 'verify untarred numbers' '
+	rm -rf master &&
+	gzip -dc large.tar.gz | tar -xf - &&
+	test_cmp repos/large/numbers master/numbers
+'
+
+test_expect_success 'setup snapshot staging' '
+	cp cgitrc-store cgitrc-staging &&
+	echo "enable-snapshot-staging=1" >>cgitrc-staging &&
+	rm -rf cache/snapshots
+'
+
+test_expect_success 'get foo/snapshot/master.tar.gz with staging' '
+	CGIT_CONFIG="$PWD/cgitrc-staging" QUERY_STRING="url=foo/snapshot/master.tar.gz" cgit |
+	strip_headers >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'tar is staged' '
+	ls cache/snapshots >output &&
+	test_line_count = 2 output &&
+	grep "\.tar$" output
+'
+
+test_expect_success XZ 'get foo/snapshot/master.tar.xz from staged tar' '
+	CGIT_CONFIG="$PWD/cgitrc-staging" QUERY_STRING="url=foo/snapshot/master.tar.xz" cgit |
+	strip_headers >master.tar.xz &&
+	rm -rf master &&
+	xz -dc master.tar.xz | tar -xf - &&
+	grep "^5$" master/file-5
+'
+
+test_expect_success 'pregenerate snapshots of tags' '
+	git -C repos/foo tag v1.0 &&
+	rm -rf cache/snapshots &&
+	sed -e "s/^snapshots=.*/snapshots=tar.gz zip/" cgitrc-store >cgitrc-pregenerate &&
+	CGIT_CONFIG="$PWD/cgitrc-pregenerate" cgit --pregenerate-snapshots --jobs=2
+'
+
+test_expect_success 'tag snapshots are stored' '
+	ls cache/snapshots >stored &&
+	grep "\.tar\.gz$" stored &&
+	grep "\.zip$" stored
+'
+
+test_expect_success 'get foo/snapshot/foo-1.0.tar.gz from store' '
+	CGIT_CONFIG="$PWD/cgitrc-pregenerate" QUERY_STRING="url=foo/snapshot/foo-1.0.tar.gz" cgit |
+	strip_headers >foo-1.0.tar.gz &&
+	ls cache/snapshots >output &&
+	test_cmp stored output &&
+	gunzip --test foo-1.0.tar.gz
+'
+
 test_done
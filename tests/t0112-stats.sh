@@ -0,0 +1,78 @@
+#!/bin/sh
+
+test_description='Check content on stats page'
+. ./setup.sh
+
+# A synthetic history with one commit by each of 10000 authors, all of
+# them inside the current week.
+test_expect_success 'setup repo with many authors' '
+	test_create_repo repos/authors &&
+	head=$(git -C repos/authors symbolic-ref HEAD) &&
+	now=$(date +%s) &&
+	awk -v head=$head -v now=$now "BEGIN {
+		for (i = 1; i <= 10000; i++) {
+			printf \"commit %s\\n\", head;
+			printf \"author Author %05d <a%d@example.org> %d +0000\\n\", i, i, now;
+			printf \"committer C O Mitter <c@example.org> %d +0000\\n\", now;
+			printf \"data 9\\ncommit %d\\n\", i % 10;
+			if (i == 1)
+				printf \"M 644 inline file\\ndata 2\\n1\\n\";
+			printf \"\\n\";
+		}
+	}" >stream &&
+	git -C repos/authors fast-import --quiet <stream &&
+	cat >>cgitrc <<-EOF
+	enable-stats-cache=1
+	cache-repo-ttl=0
+
+	repo.url=authors
+	repo.path=$PWD/repos/authors/.git
+	repo.max-stats=year
+	EOF
+'
+
+test_expect_success 'generate authors/stats' '
+	cgit_url "authors/stats" >tmp
+'
+test_expect_success 'find top author' 'grep "Author 00001" tmp'
+test_expect_success 'find combined authors' 'grep "Others (9990)" tmp'
+test_expect_success 'find total' "grep \"<td class='sum'>10000</td></tr>\" tmp"
+
+test_expect_success 'generate authors/stats per year for all authors' '
+	cgit_url "authors/stats&period=y&ofs=-1" >tmp
+'
+test_expect_success 'find last author' 'grep "Author 10000" tmp'
+test_expect_success 'no combined authors' '! grep "Others" tmp'
+
+test_expect_success 'stats aggregate is cached' 'test -d cache/stats'
+
+test_expect_success 'add commit by new author' '
+	(
+		cd repos/authors &&
+		echo 2 >file &&
+		git add file &&
+		git commit -m "late commit" --author="Late Author <late@example.org>"
+	)
+'
+test_expect_success 'generate authors/stats again' '
+	cgit_url "authors/stats&period=y&ofs=-1" >tmp
+'
+test_expect_success 'find new author' 'grep "Late Author" tmp'
+test_expect_success 'find new total' "grep \"<td class='sum'>10001</td></tr>\" tmp"
+
+# The cached aggregate is only extended by the new commits: an author
+# renamed in the cache keeps the new name, which a full walk would undo.
+test_expect_success 'stats cache is updated incrementally' '
+	sed -i -e "s/^a Author 09999/a Cached 09999/" cache/stats/* &&
+	(
+		cd repos/authors &&
+		echo 3 >file &&
+		git commit -a -m "later commit" --author="Later Author <later@example.org>"
+	) &&
+	cgit_url "authors/stats&period=y&ofs=-1" >tmp &&
+	grep "Later Author" tmp &&
+	grep "Cached 09999" tmp &&
+	! grep "Author 09999" tmp
+'
+
+test_done
@@ -0,0 +1,128 @@
+#!/bin/sh
+
+test_description='Check content on blame page'
+. ./setup.sh
+
+# Generate the blame page for "file" with the given cgitrc, leaving out
+# the headers and the footer with the current time.
+cgit_blame()
+{
+	CGIT_CONFIG="$PWD/$1" QUERY_STRING="url=blame/blame/file" cgit |
+	strip_headers | grep -v "generated by"
+}
+
+test_expect_success 'setup blame repo' '
+	test_create_repo repos/blame &&
+	(
+		cd repos/blame &&
+		test_write_lines 1 2 3 4 5 6 7 8 9 10 >file &&
+		git add file &&
+		git commit -m "add file" &&
+		test_write_lines 1 2 three 4 5 6 7 8 9 10 >file &&
+		git commit -a -m "change line 3" &&
+		test_write_lines 1 2 three 4 5 6 7 8 9 10 11 12 >file &&
+		git commit -a -m "append lines"
+	) &&
+	cat >>cgitrc <<-EOF &&
+	cache-dynamic-ttl=0
+	cache-repo-ttl=0
+
+	repo.url=blame
+	repo.path=$PWD/repos/blame/.git
+	repo.enable-blame=1
+	EOF
+	cp cgitrc cgitrc-blame-cache &&
+	echo "enable-blame-cache=1" >>cgitrc-blame-cache
+'
+
+test_expect_success 'generate blame without cache' 'cgit_blame cgitrc >expect'
+test_expect_success 'find last commit' 'grep "append lines" expect'
+
+test_expect_success 'generate blame with cold cache' '
+	cgit_blame cgitrc-blame-cache >actual &&
+	test_cmp expect actual
+'
+test_expect_success 'blame is cached' 'test -d cache/blame'
+
+test_expect_success 'generate blame with warm cache' '
+	cgit_blame cgitrc-blame-cache >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'change file' '
+	(
+		cd repos/blame &&
+		test_write_lines 1 2 three 4 five 6 7 8 9 10 11 12 >file &&
+		git commit -a -m "change line 5"
+	)
+'
+test_expect_success 'generate blame without cache' 'cgit_blame cgitrc >expect'
+test_expect_success 'find new commit' 'grep "change line 5" expect'
+
+test_expect_success 'generate blame from cached ancestor' '
+	cgit_blame cgitrc-blame-cache >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'merge side branch' '
+	(
+		cd repos/blame &&
+		git checkout -b side HEAD^ &&
+		test_write_lines one 2 three 4 5 6 7 8 9 10 11 12 >file &&
+		git commit -a -m "change line 1" &&
+		git checkout - &&
+		git merge --no-commit side &&
+		test_write_lines one 2 three 4 5 6 7 8 9 10 11 12 >file &&
+		git commit -a -m "merge side"
+	)
+'
+test_expect_success 'generate blame without cache' 'cgit_blame cgitrc >expect'
+test_expect_success 'find side commit' 'grep "change line 1" expect'
+
+test_expect_success 'generate blame across merge from cached ancestor' '
+	cgit_blame cgitrc-blame-cache >actual &&
+	test_cmp expect actual
+'
+
+# A history of 500 commits, each of which changes one more line of a
+# 500 line file, which takes well over a millisecond to blame.
+test_expect_success 'setup repo with many changes' '
+	test_create_repo repos/budget &&
+	head=$(git -C repos/budget symbolic-ref HEAD) &&
+	awk -v head=$head "BEGIN {
+		for (i = 1; i <= 500; i++) {
+			printf \"commit %s\\n\", head;
+			printf \"committer C O Mitter <c@example.org> %d +0000\\n\", 1000000000 + i;
+			printf \"data <<EOT\\nchange line %d\\nEOT\\n\", i;
+			printf \"M 644 inline file\\ndata <<EOT\\n\";
+			for (j = 1; j <= 500; j++)
+				printf \"%s %d\\n\", j <= i ? \"changed\" : \"line\", j;
+			printf \"EOT\\n\\n\";
+		}
+	}" >stream &&
+	git -C repos/budget fast-import --quiet <stream &&
+	cat >>cgitrc <<-EOF
+	repo.url=budget
+	repo.path=$PWD/repos/budget/.git
+	repo.enable-blame=1
+	EOF
+'
+
+test_expect_success 'generate blame within budget' '
+	cgit_url_with "blame-budget=1" "budget/blame/file" >tmp
+'
+test_expect_success 'find budget warning' 'grep "blame-warning" tmp'
+test_expect_success 'find older than link' '
+	grep "older than" tmp &&
+	sed -n "s/.*blame\/file?id=\([0-9a-f]*\)[^>]*>older than.*/\1/p" tmp |
+		head -n 1 >older &&
+	test -s older
+'
+
+test_expect_success 'continue blame from older than link' '
+	cgit_url_with "blame-budget=0" "budget/blame/file&id=$(cat older)" >tmp &&
+	grep "<table class=.blame blob.>" tmp &&
+	! grep "older than" tmp
+'
+
+test_done
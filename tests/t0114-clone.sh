@@ -0,0 +1,170 @@
+#!/bin/sh
+
+test_description='Check http clone support'
+. ./setup.sh
+
+# Print each argument as a pkt-line, except for "0000" (flush) and "0001"
+# (delimiter), which are printed as is.
+pkt_lines()
+{
+	for line
+	do
+		case "$line" in
+		0000|0001)
+			printf "%s" "$line"
+			;;
+		*)
+			printf "%04x%s\n" $((${#line} + 5)) "$line"
+			;;
+		esac
+	done
+}
+
+# Post the request in "request" to git-upload-pack of foo, using protocol
+# version 2.
+cgit_upload_pack()
+{
+	CGIT_CONFIG="$PWD/cgitrc-smart" HTTP_GIT_PROTOCOL=version=2 \
+	REQUEST_METHOD=POST CONTENT_LENGTH=$(($(wc -c <request))) \
+	QUERY_STRING="url=foo/git-upload-pack" cgit <request
+}
+
+# Generate info/refs of foo with the given cgitrc, leaving out the headers.
+cgit_info_refs()
+{
+	CGIT_CONFIG="$PWD/$1" QUERY_STRING="url=foo/info/refs" cgit |
+	strip_headers
+}
+
+test_expect_success 'setup' '
+	git -C repos/foo tag v1.0 &&
+	git -C repos/foo tag -m "annotated" v1.1 &&
+	cp cgitrc cgitrc-smart &&
+	echo "enable-smart-http=1" >>cgitrc-smart &&
+	{
+		echo "cache-dynamic-ttl=0" &&
+		echo "cache-repo-ttl=0" &&
+		cat cgitrc &&
+		echo "enable-fragment-cache=1"
+	} >cgitrc-fragments
+'
+
+test_expect_success 'generate dumb info/refs' '
+	cgit_query "url=foo/info/refs&service=git-upload-pack" >tmp
+'
+test_expect_success 'find master' 'grep "refs/heads/master" tmp'
+test_expect_success 'no service announcement' '! grep "service=" tmp'
+test_expect_success 'find lightweight tag' '
+	grep "^$(git -C repos/foo rev-parse v1.0)	refs/tags/v1.0$" tmp &&
+	! grep "refs/tags/v1.0^{}" tmp
+'
+test_expect_success 'find peeled annotated tag' '
+	grep "^$(git -C repos/foo rev-parse v1.1)	refs/tags/v1.1$" tmp &&
+	grep "^$(git -C repos/foo rev-parse v1.1^{})	refs/tags/v1.1^{}$" tmp
+'
+
+test_expect_success 'generate info/refs without fragment cache' '
+	cgit_info_refs cgitrc >expect
+'
+test_expect_success 'generate info/refs with cold fragment cache' '
+	cgit_info_refs cgitrc-fragments >actual &&
+	test_cmp expect actual
+'
+test_expect_success 'generate info/refs with warm fragment cache' '
+	cgit_info_refs cgitrc-fragments >actual &&
+	test_cmp expect actual
+'
+test_expect_success 'generate info/refs after adding a tag' '
+	git -C repos/foo tag -m "annotated" v1.2 &&
+	cgit_info_refs cgitrc-fragments >actual &&
+	grep "refs/tags/v1.2^{}" actual
+'
+
+test_expect_success 'generate smart info/refs' '
+	CGIT_CONFIG="$PWD/cgitrc-smart" \
+	QUERY_STRING="url=foo/info/refs&service=git-upload-pack" cgit >tmp
+'
+test_expect_success 'check content type' '
+	grep "^Content-Type: application/x-git-upload-pack-advertisement" tmp
+'
+test_expect_success 'check cache control' '
+	grep "^Cache-Control: no-cache, max-age=0, must-revalidate" tmp
+'
+test_expect_success 'find service announcement' '
+	grep "# service=git-upload-pack" tmp
+'
+test_expect_success 'find master' 'grep "refs/heads/master" tmp'
+
+test_expect_success 'generate smart info/refs for protocol v2' '
+	CGIT_CONFIG="$PWD/cgitrc-smart" HTTP_GIT_PROTOCOL=version=2 \
+	QUERY_STRING="url=foo/info/refs&service=git-upload-pack" cgit >tmp
+'
+test_expect_success 'find version 2' 'grep "version 2" tmp'
+test_expect_success 'find ls-refs' 'grep "ls-refs" tmp'
+test_expect_success 'no service announcement' '! grep "service=" tmp'
+
+test_expect_success 'list branches' '
+	pkt_lines "command=ls-refs" 0001 "ref-prefix refs/heads/" 0000 >request &&
+	cgit_upload_pack >tmp
+'
+test_expect_success 'check content type' '
+	grep "^Content-Type: application/x-git-upload-pack-result" tmp
+'
+test_expect_success 'check cache control' '
+	grep "^Cache-Control: no-cache, max-age=0, must-revalidate" tmp
+'
+test_expect_success 'find master' 'grep "refs/heads/master" tmp'
+test_expect_success 'no tags' '! grep "refs/tags" tmp'
+
+test_expect_success 'fetch master' '
+	oid=$(git -C repos/foo rev-parse master) &&
+	pkt_lines "command=fetch" 0001 "no-progress" "want $oid" "done" 0000 \
+		>request &&
+	cgit_upload_pack | strip_headers >response
+'
+test_expect_success 'find packfile' 'grep -a "packfile" response'
+
+test_expect_success PERL 'index fetched pack' '
+	perl -e "
+		binmode STDIN;
+		binmode STDOUT;
+		while (read(STDIN, \$len, 4) == 4) {
+			\$len = hex(\$len);
+			next if \$len < 4;
+			read(STDIN, \$data, \$len - 4);
+			print substr(\$data, 1) if \$data =~ /^\\x01/;
+		}
+	" <response >pack &&
+	test_create_repo fetched &&
+	git -C fetched index-pack --stdin <pack &&
+	git -C fetched cat-file -e $oid
+'
+
+test_expect_success 'list branches with a gzipped request' '
+	pkt_lines "command=ls-refs" 0001 "ref-prefix refs/heads/" 0000 |
+	gzip -c >request &&
+	CGIT_CONFIG="$PWD/cgitrc-smart" HTTP_GIT_PROTOCOL=version=2 \
+	HTTP_CONTENT_ENCODING=gzip REQUEST_METHOD=POST \
+	CONTENT_LENGTH=$(($(wc -c <request))) \
+	QUERY_STRING="url=foo/git-upload-pack" cgit <request >tmp &&
+	grep "refs/heads/master" tmp &&
+	! grep "refs/tags" tmp
+'
+
+test_expect_success 'fail cleanly if upload-pack cannot be started' '
+	pkt_lines "command=ls-refs" 0000 >request &&
+	cgit_bin=$(command -v cgit) &&
+	CGIT_CONFIG="$PWD/cgitrc-smart" HTTP_GIT_PROTOCOL=version=2 \
+	REQUEST_METHOD=POST CONTENT_LENGTH=$(($(wc -c <request))) \
+	QUERY_STRING="url=foo/git-upload-pack" PATH=/nonexistent \
+	"$cgit_bin" <request >tmp &&
+	grep "^Status: 500" tmp &&
+	! grep "x-git-upload-pack-result" tmp
+'
+
+test_expect_success 'no upload-pack without enable-smart-http' '
+	cgit_query "url=foo/git-upload-pack" >tmp &&
+	grep "^Status: 404" tmp
+'
+
+test_done
@@ -0,0 +1,110 @@
+#!/bin/sh
+
+test_description='Check content on refs page'
+. ./setup.sh
+
+test_expect_success 'setup branches and tags' '
+	for name in alpha-1 alpha-2 beta-1
+	do
+		git -C repos/foo branch $name master~1 || return 1
+	done &&
+	for n in 1 2 3
+	do
+		GIT_COMMITTER_DATE="@$((1700000000 + $n * 60)) +0000" \
+		git -C repos/foo tag -m "tag $n" v$n || return 1
+	done
+'
+
+test_expect_success 'generate foo refs' 'cgit_url "foo/refs" >tmp'
+test_expect_success 'find all branches and tags' '
+	for name in alpha-1 alpha-2 beta-1 master v1 v2 v3
+	do
+		grep ">$name</a>" tmp || return 1
+	done
+'
+test_expect_success 'no pager' '! grep "ofs=" tmp'
+
+test_expect_success 'generate foo refs with two refs per page' '
+	cgit_url_with max-ref-count=2 "foo/refs" >tmp
+'
+test_expect_success 'find first branches and newest tags' '
+	grep ">alpha-1</a>" tmp &&
+	grep ">alpha-2</a>" tmp &&
+	grep ">v3</a>" tmp &&
+	grep ">v2</a>" tmp
+'
+test_expect_success 'no further branches and tags' '
+	! grep ">beta-1</a>" tmp &&
+	! grep ">master</a>" tmp &&
+	! grep ">v1</a>" tmp
+'
+test_expect_success 'find links to branches and tags' '
+	grep "/foo/refs/heads" tmp &&
+	grep "/foo/refs/tags" tmp
+'
+
+test_expect_success 'generate first page of branches' '
+	cgit_url_with max-ref-count=2 "foo/refs/heads" >tmp
+'
+test_expect_success 'find first branches' '
+	grep ">alpha-1</a>" tmp &&
+	grep ">alpha-2</a>" tmp &&
+	! grep ">beta-1</a>" tmp &&
+	! grep ">master</a>" tmp
+'
+test_expect_success 'no tags' '! grep ">v[0-9]</a>" tmp'
+test_expect_success 'find next page' 'grep "ofs=2.>\[next\]" tmp'
+test_expect_success 'no previous page' '! grep "\[prev\]" tmp'
+
+test_expect_success 'generate second page of branches' '
+	cgit_url_with max-ref-count=2 "foo/refs/heads&ofs=2" >tmp
+'
+test_expect_success 'find last branches' '
+	! grep ">alpha-1</a>" tmp &&
+	! grep ">alpha-2</a>" tmp &&
+	grep ">beta-1</a>" tmp &&
+	grep ">master</a>" tmp
+'
+test_expect_success 'find previous page' 'grep "\[prev\]" tmp'
+test_expect_success 'no next page' '! grep "\[next\]" tmp'
+
+test_expect_success 'generate branches with prefix' '
+	cgit_url_with max-ref-count=2 "foo/refs/heads/alpha-" >tmp
+'
+test_expect_success 'find matching branches' '
+	grep ">alpha-1</a>" tmp &&
+	grep ">alpha-2</a>" tmp &&
+	! grep ">beta-1</a>" tmp &&
+	! grep ">master</a>" tmp
+'
+test_expect_success 'no pager' '! grep "ofs=" tmp'
+
+test_expect_success 'generate branches containing a string' '
+	cgit_url_with max-ref-count=2 "foo/refs/heads&q=-1" >tmp
+'
+test_expect_success 'find matching branches' '
+	grep ">alpha-1</a>" tmp &&
+	grep ">beta-1</a>" tmp &&
+	! grep ">alpha-2</a>" tmp &&
+	! grep ">master</a>" tmp
+'
+
+test_expect_success 'generate first page of tags' '
+	cgit_url_with max-ref-count=2 "foo/refs/tags" >tmp
+'
+test_expect_success 'find newest tags' '
+	grep -o ">v[0-9]</a>" tmp >actual &&
+	printf ">v%d</a>\n" 3 2 >expect &&
+	test_cmp expect actual
+'
+
+test_expect_success 'generate second page of tags' '
+	cgit_url_with max-ref-count=2 "foo/refs/tags&ofs=2" >tmp
+'
+test_expect_success 'find oldest tag' '
+	grep -o ">v[0-9]</a>" tmp >actual &&
+	echo ">v1</a>" >expect &&
+	test_cmp expect actual
+'
+
+test_done
@@ -0,0 +1,87 @@
+#!/bin/sh
+
+test_description='Check content of atom feeds'
+. ./setup.sh
+
+# Generate the feed of foo with the given cgitrc, including the headers.
+cgit_atom()
+{
+	CGIT_CONFIG="$PWD/$1" QUERY_STRING="url=foo/atom" cgit
+}
+
+test_expect_success 'setup' '
+	{
+		echo "cache-dynamic-ttl=0" &&
+		echo "cache-repo-ttl=0" &&
+		cat cgitrc &&
+		echo "enable-fragment-cache=1"
+	} >cgitrc-fragments
+'
+
+test_expect_success 'generate foo atom' 'cgit_atom cgitrc >tmp'
+test_expect_success 'check content type' '
+	grep "^Content-Type: text/xml; charset=utf-8" tmp
+'
+test_expect_success 'find commits' '
+	grep "<title>commit 5</title>" tmp &&
+	grep "<title>commit 1</title>" tmp
+'
+test_expect_success 'find ETag' 'grep "^ETag: \"[0-9a-f]*\"" tmp'
+
+test_expect_success 'generate foo atom with cold fragment cache' '
+	strip_headers <tmp >expect &&
+	cgit_atom cgitrc-fragments >tmp &&
+	strip_headers <tmp >actual &&
+	test_cmp expect actual
+'
+test_expect_success 'generate foo atom with warm fragment cache' '
+	cgit_atom cgitrc-fragments | strip_headers >actual &&
+	test_cmp expect actual
+'
+test_expect_success 'warm fragment cache does not read objects' '
+	mkdir objects &&
+	mv repos/foo/.git/objects/[0-9a-f][0-9a-f] objects/ &&
+	test_when_finished "mv objects/* repos/foo/.git/objects/" &&
+	cgit_atom cgitrc-fragments | strip_headers >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'answer conditional request' '
+	etag=$(sed -n "s/^ETag: \(\".*\"\)$/\1/p" tmp) &&
+	test -n "$etag" &&
+	HTTP_IF_NONE_MATCH="$etag" cgit_atom cgitrc-fragments >tmp &&
+	grep "^Status: 304 Not Modified" tmp &&
+	! grep "<feed" tmp
+'
+test_expect_success 'answer conditional request with other ETag' '
+	HTTP_IF_NONE_MATCH="\"0000\"" cgit_atom cgitrc-fragments >tmp &&
+	! grep "^Status: 304" tmp &&
+	grep "<feed" tmp
+'
+
+test_expect_success 'add a commit' '
+	echo 6 >repos/foo/file-6 &&
+	git -C repos/foo add file-6 &&
+	git -C repos/foo commit -m "commit 6"
+'
+test_expect_success 'generate foo atom after the tip changed' '
+	HTTP_IF_NONE_MATCH="$etag" cgit_atom cgitrc-fragments >tmp &&
+	! grep "^Status: 304" tmp &&
+	! grep "^ETag: $etag" tmp &&
+	grep "<title>commit 6</title>" tmp
+'
+
+test_expect_success 'conditional request is not kept in the page cache' '
+	rm -rf cache && mkdir cache &&
+	cgit_atom cgitrc-fragments >tmp &&
+	etag=$(sed -n "s/^ETag: \(\".*\"\)$/\1/p" tmp) &&
+	test -n "$etag" &&
+	HTTP_IF_NONE_MATCH="$etag" cgit_atom cgitrc >tmp &&
+	grep "^Status: 304 Not Modified" tmp &&
+	cgit_atom cgitrc >tmp &&
+	! grep "^Status: 304" tmp &&
+	grep "<feed" tmp &&
+	grep "<title>commit 6</title>" tmp
+'
+
+test_done
@@ -12,6 +12,7 @@
 #include "ui-atom.h"
 #include "html.h"
 #include "ui-shared.h"
+#include "object-file.h"
 
 static void add_entry(struct commit *commit, const char *host)
 {
@@ -80,10 +81,17 @@ static void add_entry(struct commit *commit, const char *host)
 }
 
 
-void cgit_print_atom(char *tip, const char *path, int max_count)
-{
+struct atom_feed {
+	char *tip;
+	const char *path;
+	int max_count;
 	char *host;
-	const char *argv[] = {NULL, tip, NULL, NULL, NULL};
+};
+
+static int print_feed(void *data)
+{
+	struct atom_feed *feed = data;
+	const char *argv[] = {NULL, feed->tip, NULL, NULL, NULL};
 	struct commit *commit;
 	struct rev_info rev;
 	int argc = 2;
@@ -91,12 +99,12 @@ void cgit_print_atom(char *tip, const char *path, int max_count)
 
 	if (ctx.qry.show_all)
 		argv[1] = "--all";
-	else if (!tip)
+	else if (!feed->tip)
 		argv[1] = ctx.qry.head;
 
-	if (path) {
+	if (feed->path) {
 		argv[argc++] = "--";
-		argv[argc++] = path;
+		argv[argc++] = feed->path;
 	}
 
 	repo_init_revisions(the_repository, &rev, NULL);
@@ -104,40 +112,36 @@ void cgit_print_atom(char *tip, const char *path, int max_count)
 	rev.commit_format = CMIT_FMT_DEFAULT;
 	rev.verbose_header = 1;
 	rev.show_root_diff = 0;
-	rev.max_count = max_count;
+	rev.max_count = feed->max_count;
 	setup_revisions(argc, argv, &rev, NULL);
 	prepare_revision_walk(&rev);
 
-	host = cgit_hosturl();
-	ctx.page.mimetype = "text/xml";
-	ctx.page.charset = "utf-8";
-	cgit_print_http_headers();
 	html("<feed xmlns='http://www.w3.org/2005/Atom'>\n");
 	html("<title>");
 	html_txt(ctx.repo->name);
-	if (path) {
+	if (feed->path) {
 		html("/");
-		html_txt(path);
+		html_txt(feed->path);
 	}
-	if (tip && !ctx.qry.show_all) {
+	if (feed->tip && !ctx.qry.show_all) {
 		html(", branch ");
-		html_txt(tip);
+		html_txt(feed->tip);
 	}
 	html("</title>\n");
 	html("<subtitle>");
 	html_txt(ctx.repo->desc);
 	html("</subtitle>\n");
-	if (host) {
+	if (feed->host) {
 		char *fullurl = cgit_currentfullurl();
 		char *repourl = cgit_repourl(ctx.repo->url);
 		html("<id>");
-		html_txtf("%s%s%s", cgit_httpscheme(), host, fullurl);
+		html_txtf("%s%s%s", cgit_httpscheme(), feed->host, fullurl);
 		html("</id>\n");
 		html("<link rel='self' href='");
-		html_attrf("%s%s%s", cgit_httpscheme(), host, fullurl);
+		html_attrf("%s%s%s", cgit_httpscheme(), feed->host, fullurl);
 		html("'/>\n");
 		html("<link rel='alternate' type='text/html' href='");
-		html_attrf("%s%s%s", cgit_httpscheme(), host, repourl);
+		html_attrf("%s%s%s", cgit_httpscheme(), feed->host, repourl);
 		html("'/>\n");
 		free(fullurl);
 		free(repourl);
@@ -150,10 +154,81 @@ void cgit_print_atom(char *tip, const char *path, int max_count)
 			html("</updated>\n");
 			first = false;
 		}
-		add_entry(commit, host);
+		add_entry(commit, feed->host);
 		release_commit_memory(the_repository->parsed_objects, commit);
 		commit->parents = NULL;
 	}
 	html("</feed>\n");
-	free(host);
+	return 0;
+}
+
+/*
+ * Identify the feed by the commit it starts from, or the state of all
+ * refs, and the settings it is shown with. Only the refs are read, so
+ * that an unchanged feed can be answered without reading any objects.
+ */
+static int get_feed_id(struct atom_feed *feed, struct object_id *oid)
+{
+	struct strbuf id = STRBUF_INIT;
+	struct object_id tip;
+	char *fullurl;
+
+	if (ctx.qry.show_all)
+		cgit_get_ref_state(&tip);
+	else if (repo_get_oid(the_repository,
+			      feed->tip ? feed->tip : ctx.qry.head, &tip))
+		return -1;
+
+	fullurl = cgit_currentfullurl();
+	strbuf_addf(&id, "%s\n%d\n%s\n%s%s%s\n%s\n%s\n%d\n",
+		    oid_to_hex(&tip), feed->max_count,
+		    feed->path ? feed->path : "", cgit_httpscheme(),
+		    feed->host ? feed->host : "", fullurl, ctx.repo->name,
+		    ctx.repo->desc, ctx.cfg.noplainemail);
+	hash_object_file(the_hash_algo, id.buf, id.len, OBJ_BLOB, oid);
+	strbuf_release(&id);
+	free(fullurl);
+	return 0;
+}
+
+static int etag_matches(const char *etag)
+{
+	const char *header = ctx.env.http_if_none_match;
+
+	if (!header)
+		return 0;
+	return !strcmp(header, "*") || strstr(header, fmt("\"%s\"", etag));
+}
+
+void cgit_print_atom(char *tip, const char *path, int max_count)
+{
+	struct atom_feed feed;
+	struct object_id id;
+	char hex[GIT_MAX_HEXSZ + 1];
+	int has_id;
+
+	feed.tip = tip;
+	feed.path = path;
+	feed.max_count = max_count;
+	feed.host = cgit_hosturl();
+	has_id = !get_feed_id(&feed, &id);
+
+	ctx.page.mimetype = "text/xml";
+	ctx.page.charset = "utf-8";
+	if (has_id) {
+		ctx.page.etag = oid_to_hex_r(hex, &id);
+		if (etag_matches(ctx.page.etag)) {
+			ctx.page.status = 304;
+			ctx.page.statusmsg = "Not Modified";
+			cgit_print_http_headers();
+			free(feed.host);
+			return;
+		}
+	}
+	cgit_print_http_headers();
+	if (has_id)
+		cgit_print_fragment(fmt("atom %s", hex), print_feed, &feed);
+	else
+		print_feed(&feed);
+	free(feed.host);
 }
@@ -13,15 +13,129 @@
 #include "html.h"
 #include "ui-shared.h"
 #include "strvec.h"
+#include "alloc.h"
 #include "blame.h"
+#include "cache.h"
+#include "commit-slab.h"
+#include "oidset.h"
+#include "tree-walk.h"
+
+/* A run of lines of the blamed file which came from line `s_lno` of
+ * `path` in `commit`, or from some commit before it if the blame-budget
+ * ran out (`partial`).
+ */
+struct blamed_range {
+	unsigned long lno;
+	unsigned long num_lines;
+	unsigned long s_lno;
+	struct commit *commit;
+	const char *path;
+	int partial;
+
+	/* Set up for printing by prepare_blamed_commits() */
+	size_t commit_nr;
+	size_t width;
+};
+
+struct blamed_ranges {
+	struct blamed_range *items;
+	size_t nr, alloc;
+};
+
+/* What is shown for a commit in the hashes column, computed once per
+ * page and commit
+ */
+struct blamed_commit {
+	char *abbrev;
+	char *detail;
+	char *parent;
+};
+
+struct blamed_commits {
+	struct blamed_commit *items;
+	size_t nr, alloc;
+
+	/* runs of newlines and spaces long enough for any range */
+	char *newlines;
+	char *spaces;
+};
+
+define_commit_slab(blamed_commit_slab, size_t);
+
+/* Number of changes to a file searched for a cached blame to start from */
+#define BLAME_CACHE_DEPTH 32
+
+/* When the blame-budget runs out, every commit which is still to be
+ * searched is treated like a boundary commit, so that assign_blame()
+ * finishes right away. The signal handler only sets `budget_expired`.
+ * The age limit of the walk is raised from the comparison function of
+ * the scoreboard's queue, which runs whenever a commit is queued as the
+ * queue always holds a sentinel: an empty commit, older than all others,
+ * which assign_blame() skips. It marks the commits it did not search as
+ * UNINTERESTING; the lines left on them are remembered in `partial`.
+ */
+struct blame_budget {
+	struct rev_info *revs;
+	struct commit *bottom;
+	struct oidset partial;
+};
+
+static volatile sig_atomic_t budget_expired;
+
+static void blame_budget_expired(int sig)
+{
+	budget_expired = 1;
+}
+
+static int blame_budget_compare(const void *a, const void *b, void *data)
+{
+	struct blame_budget *budget = data;
+
+	/* TIME_MAX would read as "no limit" */
+	if (budget_expired)
+		budget->revs->max_age = TIME_MAX - 1;
+	return compare_commits_by_commit_date(a, b, NULL);
+}
+
+static void blame_budget_entry(struct blame_entry *ent, void *data)
+{
+	struct blame_budget *budget = data;
+	struct commit *commit = ent->suspect->commit;
+
+	if (budget_expired && commit != budget->bottom && commit->parents &&
+	    (commit->object.flags & UNINTERESTING))
+		oidset_insert(&budget->partial, &commit->object.oid);
+}
+
+static void start_blame_budget(struct sigaction *old)
+{
+	struct itimerval timer = { 0 };
+	struct sigaction sa = { 0 };
+
+	budget_expired = 0;
+	sa.sa_handler = blame_budget_expired;
+	sa.sa_flags = SA_RESTART;
+	sigaction(SIGALRM, &sa, old);
+	timer.it_value.tv_sec = ctx.cfg.blame_budget / 1000;
+	timer.it_value.tv_usec = (ctx.cfg.blame_budget % 1000) * 1000;
+	setitimer(ITIMER_REAL, &timer, NULL);
+}
+
+static void stop_blame_budget(struct sigaction *old)
+{
+	struct itimerval timer = { 0 };
+
+	setitimer(ITIMER_REAL, &timer, NULL);
+	sigaction(SIGALRM, old, NULL);
+}
 
 
-static char *emit_suspect_detail(struct blame_origin *suspect)
+static char *emit_suspect_detail(struct commit *commit)
 {
 	struct commitinfo *info;
 	struct strbuf detail = STRBUF_INIT;
 
-	info = cgit_parse_commit(suspect->commit);
+	info = cgit_parse_commit(commit);
 
 	strbuf_addf(&detail, "author  %s", info->author);
 	if (!ctx.cfg.noplainemail)
@@ -43,83 +157,475 @@ static char *emit_suspect_detail(struct blame_origin *suspect)
 	return strbuf_detach(&detail, NULL);
 }
 
-static void emit_blame_entry_hash(struct blame_entry *ent)
+static void emit_blame_entry_hash(struct blamed_range *range,
+				  struct blamed_commits *commits)
 {
-	struct blame_origin *suspect = ent->suspect;
-	struct object_id *oid = &suspect->commit->object.oid;
-	unsigned long line = 0;
+	struct blamed_commit *c = &commits->items[range->commit_nr];
+	const char *hex = oid_to_hex(&range->commit->object.oid);
 
-	char *detail = emit_suspect_detail(suspect);
 	html("<span class='oid'>");
-	cgit_commit_link(repo_find_unique_abbrev(the_repository, oid, DEFAULT_ABBREV), detail,
-			 NULL, ctx.qry.head, oid_to_hex(oid), suspect->path);
+	if (range->partial)
+		cgit_blame_link(fmt("older than %s", c->abbrev),
+				"Continue the blame from this commit", NULL,
+				ctx.qry.head, hex, range->path);
+	else
+		cgit_commit_link(c->abbrev, c->detail, NULL, ctx.qry.head,
+				 hex, range->path);
 	html("</span>");
-	free(detail);
-
-	if (!repo_parse_commit(the_repository, suspect->commit) && suspect->commit->parents) {
-		struct commit *parent = suspect->commit->parents->item;
 
+	if (!range->partial && c->parent) {
 		html(" ");
 		cgit_blame_link("^", "Blame the previous revision", NULL,
-				ctx.qry.head, oid_to_hex(&parent->object.oid),
-				suspect->path);
+				ctx.qry.head, c->parent, range->path);
 	}
 
-	while (line++ < ent->num_lines)
-		html("\n");
+	html_raw(commits->newlines, range->num_lines);
 }
 
-static void emit_blame_entry_linenumber(struct blame_entry *ent)
+static void emit_blame_entry_linenumber(struct blamed_range *range,
+					struct strbuf *buf)
 {
-	const char *numberfmt = "<a id='n%1$d' href='#n%1$d'>%1$d</a>\n";
+	const char *numberfmt = "<a id='n%1$lu' href='#n%1$lu'>%1$lu</a>\n";
 
-	unsigned long lineno = ent->lno;
-	while (lineno < ent->lno + ent->num_lines)
-		htmlf(numberfmt, ++lineno);
+	unsigned long lineno = range->lno;
+	strbuf_reset(buf);
+	while (lineno < range->lno + range->num_lines)
+		strbuf_addf(buf, numberfmt, ++lineno);
+	html_raw(buf->buf, buf->len);
 }
 
-static void emit_blame_entry_line_background(struct blame_scoreboard *sb,
-					     struct blame_entry *ent)
+static void emit_blame_entry_line_background(struct blamed_range *range,
+					     struct blamed_commits *commits)
 {
+	html_raw(commits->newlines, range->num_lines);
+	html_raw(commits->spaces, range->width - 1);
+}
+
+/* Collect the commits shown on the page and the width of the lines of
+ * each range in a single pass, so that the columns of the page can be
+ * printed without looking at the commits or the blob again.
+ */
+static void prepare_blamed_commits(struct blamed_ranges *ranges,
+				   const char *buf, unsigned long size,
+				   struct blamed_commits *commits)
+{
+	struct blamed_commit_slab slab;
+	struct blamed_range *range;
+	struct blamed_commit *c;
+	struct commit *commit;
+	const char *pos = buf, *end = buf + size;
+	size_t i, *nr, len, max = 0;
 	unsigned long line;
-	size_t len, maxlen = 2;
-	const char* pos, *endpos;
-
-	for (line = ent->lno; line < ent->lno + ent->num_lines; line++) {
-		html("\n");
-		pos = blame_nth_line(sb, line);
-		endpos = blame_nth_line(sb, line + 1);
-		len = 0;
-		while (pos < endpos) {
-			len++;
-			if (*pos++ == '\t')
-				len = (len + 7) & ~7;
+	char ch;
+
+	init_blamed_commit_slab(&slab);
+	for (i = 0; i < ranges->nr; i++) {
+		range = &ranges->items[i];
+		commit = range->commit;
+
+		/* slab entries are 0 until set, so store commit_nr + 1 */
+		nr = blamed_commit_slab_at(&slab, commit);
+		if (!*nr) {
+			ALLOC_GROW(commits->items, commits->nr + 1, commits->alloc);
+			c = &commits->items[commits->nr];
+			c->abbrev = xstrdup(repo_find_unique_abbrev(the_repository,
+					&commit->object.oid, DEFAULT_ABBREV));
+			c->detail = emit_suspect_detail(commit);
+			c->parent = NULL;
+			if (!repo_parse_commit(the_repository, commit) && commit->parents)
+				c->parent = xstrdup(oid_to_hex(&commit->parents->item->object.oid));
+			*nr = ++commits->nr;
 		}
-		if (len > maxlen)
-			maxlen = len;
+		range->commit_nr = *nr - 1;
+
+		range->width = 2;
+		for (line = 0; line < range->num_lines; line++) {
+			len = 0;
+			while (pos < end) {
+				ch = *pos++;
+				len++;
+				if (ch == '\t')
+					len = (len + 7) & ~7;
+				else if (ch == '\n')
+					break;
+			}
+			if (len > range->width)
+				range->width = len;
+		}
+		if (range->width > max)
+			max = range->width;
+		if (range->num_lines > max)
+			max = range->num_lines;
 	}
+	clear_blamed_commit_slab(&slab);
 
-	for (len = 0; len < maxlen - 1; len++)
-		html(" ");
+	commits->newlines = xmallocz(max);
+	memset(commits->newlines, '\n', max);
+	commits->spaces = xmallocz(max);
+	memset(commits->spaces, ' ', max);
+}
+
+static void clear_blamed_commits(struct blamed_commits *commits)
+{
+	size_t i;
+
+	for (i = 0; i < commits->nr; i++) {
+		free(commits->items[i].abbrev);
+		free(commits->items[i].detail);
+		free(commits->items[i].parent);
+	}
+	free(commits->items);
+	free(commits->newlines);
+	free(commits->spaces);
+}
+
+static void add_range(struct blamed_ranges *ranges, unsigned long lno,
+		      unsigned long num_lines, unsigned long s_lno,
+		      struct commit *commit, const char *path, int partial)
+{
+	struct blamed_range *last = ranges->nr ? &ranges->items[ranges->nr - 1] : NULL;
+
+	if (last && last->commit == commit && last->path == path &&
+	    last->partial == partial &&
+	    last->lno + last->num_lines == lno &&
+	    last->s_lno + last->num_lines == s_lno) {
+		last->num_lines += num_lines;
+		return;
+	}
+	ALLOC_GROW(ranges->items, ranges->nr + 1, ranges->alloc);
+	last = &ranges->items[ranges->nr++];
+	last->lno = lno;
+	last->num_lines = num_lines;
+	last->s_lno = s_lno;
+	last->commit = commit;
+	last->path = path;
+	last->partial = partial;
+}
+
+/* Blame `path` in `commit`. If `bottom` is given, lines older than it are
+ * left blamed on `bottom`. Returns 1 if the blame-budget ran out.
+ */
+static int run_blame(struct commit *commit, struct commit *bottom,
+		     const char *path, struct blamed_ranges *ranges)
+{
+	struct strvec rev_argv = STRVEC_INIT;
+	struct rev_info revs;
+	struct blame_scoreboard sb;
+	struct blame_origin *o;
+	struct blame_entry *ent, *next;
+	struct blame_budget budget = {
+		.revs = &revs,
+		.bottom = bottom,
+	};
+	int partial;
+
+	reset_revision_walk();
+	strvec_push(&rev_argv, "blame");
+	strvec_push(&rev_argv, oid_to_hex(&commit->object.oid));
+	if (bottom)
+		strvec_pushf(&rev_argv, "^%s", oid_to_hex(&bottom->object.oid));
+	repo_init_revisions(the_repository, &revs, NULL);
+	revs.diffopt.flags.allow_textconv = 1;
+	setup_revisions(rev_argv.nr, rev_argv.v, &revs, NULL);
+	init_scoreboard(&sb);
+	sb.revs = &revs;
+	sb.repo = the_repository;
+	sb.path = path;
+	setup_scoreboard(&sb, &o);
+	o->suspects = blame_entry_prepend(NULL, 0, sb.num_lines, o);
+	oidset_init(&budget.partial, 0);
+	if (ctx.cfg.blame_budget > 0) {
+		sb.commits.compare = blame_budget_compare;
+		sb.commits.cb_data = &budget;
+		prio_queue_put(&sb.commits, alloc_commit_node(the_repository));
+		sb.found_guilty_entry = blame_budget_entry;
+		sb.found_guilty_entry_data = &budget;
+	}
+	prio_queue_put(&sb.commits, o->commit);
+	blame_origin_decref(o);
+	sb.ent = NULL;
+	sb.path = path;
+	assign_blame(&sb, 0);
+	blame_sort_final(&sb);
+	blame_coalesce(&sb);
+
+	for (ent = sb.ent; ent; ent = next) {
+		next = ent->next;
+		add_range(ranges, ent->lno, ent->num_lines, ent->s_lno,
+			  ent->suspect->commit, strintern(ent->suspect->path),
+			  oidset_contains(&budget.partial,
+					  &ent->suspect->commit->object.oid));
+		free(ent);
+	}
+	partial = oidset_size(&budget.partial) > 0;
+	oidset_clear(&budget.partial);
+	free((void *)sb.final_buf);
+	strvec_clear(&rev_argv);
+	return partial;
+}
+
+static char *blame_cache_path(void)
+{
+	return fmt("%s/blame", ctx.cfg.cache_root);
+}
+
+/* Cached blames are stored as one "<lno> <num_lines> <s_lno> <commit>
+ * <path>" line per range.
+ */
+static void write_blame(const struct blamed_ranges *ranges, struct strbuf *buf)
+{
+	const struct blamed_range *range;
+	size_t i;
+
+	strbuf_reset(buf);
+	for (i = 0; i < ranges->nr; i++) {
+		range = &ranges->items[i];
+		strbuf_addf(buf, "%lu %lu %lu %s %s\n", range->lno,
+			    range->num_lines, range->s_lno,
+			    oid_to_hex(&range->commit->object.oid), range->path);
+	}
+}
+
+static int read_blame(const char *p, struct blamed_ranges *ranges)
+{
+	unsigned long lno, num_lines, s_lno;
+	struct object_id oid;
+	struct commit *commit;
+	const char *end;
+	char *path;
+
+	while (*p) {
+		end = strchrnul(p, '\n');
+		lno = strtoul(p, (char **)&p, 10);
+		num_lines = strtoul(p, (char **)&p, 10);
+		s_lno = strtoul(p, (char **)&p, 10);
+		if (*p++ != ' ' || parse_oid_hex(p, &oid, &p) ||
+		    *p++ != ' ' || p >= end)
+			return -1;
+		commit = lookup_commit(the_repository, &oid);
+		if (!commit)
+			return -1;
+		path = xmemdupz(p, end - p);
+		add_range(ranges, lno, num_lines, s_lno, commit,
+			  strintern(path), 0);
+		free(path);
+		p = *end ? end + 1 : end;
+	}
+	return 0;
+}
+
+static int load_blame(struct commit *commit, const char *path,
+		      struct blamed_ranges *ranges)
+{
+	struct strbuf buf = STRBUF_INIT;
+	char *key = xstrfmt("%s:%s", oid_to_hex(&commit->object.oid), path);
+	int ret = -1;
+
+	ranges->nr = 0;
+	if (!cache_get(ctx.cfg.cache_size, blame_cache_path(), key, -1, &buf))
+		ret = read_blame(buf.buf, ranges);
+	if (ret)
+		ranges->nr = 0;
+	strbuf_release(&buf);
+	free(key);
+	return ret;
+}
+
+static void store_blame(struct commit *commit, const char *path,
+			const struct blamed_ranges *ranges)
+{
+	struct strbuf buf = STRBUF_INIT;
+	char *key = xstrfmt("%s:%s", oid_to_hex(&commit->object.oid), path);
+
+	write_blame(ranges, &buf);
+	cache_put(ctx.cfg.cache_size, blame_cache_path(), key, buf.buf, buf.len);
+	strbuf_release(&buf);
+	free(key);
+}
+
+/* The blame of a file is the same in every commit up to the next change
+ * of it, so results are cached for the last commit which changed the file
+ * (`*tip`). Look for the blame of `*tip`, or else of one of the previous
+ * BLAME_CACHE_DEPTH commits changing the file, which is returned.
+ */
+static struct commit *find_cached_blame(struct commit *commit,
+					const char *path,
+					const struct object_id *blob,
+					struct commit **tip,
+					struct blamed_ranges *cached)
+{
+	struct strvec rev_argv = STRVEC_INIT;
+	struct rev_info revs;
+	struct commit *c, *base = NULL;
+	struct object_id oid;
+	unsigned short mode;
+	int depth;
+
+	reset_revision_walk();
+	strvec_push(&rev_argv, "blame");
+	strvec_push(&rev_argv, oid_to_hex(&commit->object.oid));
+	strvec_push(&rev_argv, "--");
+	strvec_push(&rev_argv, path);
+	repo_init_revisions(the_repository, &revs, NULL);
+	setup_revisions(rev_argv.nr, rev_argv.v, &revs, NULL);
+	if (prepare_revision_walk(&revs))
+		goto out;
+
+	c = get_revision(&revs);
+	*tip = commit;
+	if (c && !get_tree_entry(the_repository, get_commit_tree_oid(c), path,
+				 &oid, &mode) && oideq(&oid, blob))
+		*tip = c;
+	if (!load_blame(*tip, path, cached)) {
+		base = *tip;
+		goto out;
+	}
+
+	for (depth = 0; c && depth < BLAME_CACHE_DEPTH; depth++) {
+		if (c != *tip && !load_blame(c, path, cached)) {
+			base = c;
+			break;
+		}
+		c = get_revision(&revs);
+	}
+out:
+	release_revisions(&revs);
+	strvec_clear(&rev_argv);
+	return base;
+}
+
+static size_t find_range(const struct blamed_ranges *ranges, unsigned long lno)
+{
+	size_t lo = 0, hi = ranges->nr, mid;
+
+	while (lo + 1 < hi) {
+		mid = lo + (hi - lo) / 2;
+		if (ranges->items[mid].lno <= lno)
+			lo = mid;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
+/* Replace the lines which `blame` left on the boundary commit `base` by
+ * their blame in the `cached` result for `base`. Returns -1 if that does
+ * not give the full blame, e.g. when some lines stopped at another
+ * boundary commit on a side branch merged since `base`.
+ */
+static int merge_blame(struct blamed_ranges *ranges,
+		       const struct blamed_ranges *blame,
+		       const struct blamed_ranges *cached,
+		       struct commit *base, const char *path)
+{
+	const struct blamed_range *b, *c;
+	unsigned long line, end, lno, n;
+	size_t i, j;
+
+	for (i = 0; i < blame->nr; i++) {
+		b = &blame->items[i];
+		if (b->commit != base && !b->partial &&
+		    (b->commit->object.flags & UNINTERESTING))
+			return -1;
+		if (b->commit != base) {
+			add_range(ranges, b->lno, b->num_lines, b->s_lno,
+				  b->commit, b->path, b->partial);
+			continue;
+		}
+		if (b->path != path)
+			return -1;
+		line = b->s_lno;
+		end = b->s_lno + b->num_lines;
+		lno = b->lno;
+		for (j = find_range(cached, line); line < end; j++) {
+			if (j >= cached->nr)
+				return -1;
+			c = &cached->items[j];
+			if (c->lno > line)
+				return -1;
+			n = c->lno + c->num_lines;
+			if (n <= line)
+				continue;
+			n = (n < end ? n : end) - line;
+			add_range(ranges, lno, n, c->s_lno + line - c->lno,
+				  c->commit, c->path, 0);
+			line += n;
+			lno += n;
+		}
+	}
+	return 0;
+}
+
+static int blame_with_cache(struct commit *commit, const char *path,
+			    const struct object_id *blob,
+			    struct blamed_ranges *ranges)
+{
+	struct blamed_ranges cached = { 0 }, blame = { 0 };
+	struct commit *tip, *base;
+	int partial = 0;
+
+	if (!ctx.cfg.enable_blame_cache || ctx.cfg.cache_size <= 0)
+		return run_blame(commit, NULL, path, ranges);
+
+	path = strintern(path);
+	base = find_cached_blame(commit, path, blob, &tip, &cached);
+	if (base == tip) {
+		*ranges = cached;
+		return 0;
+	}
+	if (base) {
+		partial = run_blame(tip, base, path, &blame);
+		if (merge_blame(ranges, &blame, &cached, base, path)) {
+			ranges->nr = 0;
+			base = NULL;
+		}
+		free(blame.items);
+	}
+	free(cached.items);
+	if (!base)
+		partial = run_blame(tip, NULL, path, ranges);
+	if (!partial)
+		store_blame(tip, path, ranges);
+	return partial;
+}
+
+/* Returns 1 if only a partial blame could be computed within the
+ * blame-budget, which is shared by all walks needed for the blame.
+ */
+static int compute_blame(struct commit *commit, const char *path,
+			 const struct object_id *blob,
+			 struct blamed_ranges *ranges)
+{
+	struct sigaction old;
+	int partial;
+
+	if (ctx.cfg.blame_budget > 0)
+		start_blame_budget(&old);
+	partial = blame_with_cache(commit, path, blob, ranges);
+	if (ctx.cfg.blame_budget > 0)
+		stop_blame_budget(&old);
+	return partial;
 }
 
 struct walk_tree_context {
 	char *curr_rev;
+	struct commit *commit;
 	int match_baselen;
 	int state;
 };
 
 static void print_object(const struct object_id *oid, const char *path,
-			 const char *basename, const char *rev)
+			 const char *basename, const char *rev,
+			 struct commit *commit)
 {
 	enum object_type type;
 	char *buf;
 	unsigned long size;
-	struct strvec rev_argv = STRVEC_INIT;
-	struct rev_info revs;
-	struct blame_scoreboard sb;
-	struct blame_origin *o;
-	struct blame_entry *ent = NULL;
+	struct blamed_ranges ranges = { 0 };
+	struct blamed_commits commits = { 0 };
+	struct strbuf linenumbers = STRBUF_INIT;
+	size_t i;
+	int partial;
 
 	type = odb_read_object_info(the_repository->objects, oid, &size);
 	if (type == OBJ_BAD) {
@@ -135,24 +641,7 @@ static void print_object(const struct object_id *oid, const char *path,
 		return;
 	}
 
-	strvec_push(&rev_argv, "blame");
-	strvec_push(&rev_argv, rev);
-	repo_init_revisions(the_repository, &revs, NULL);
-	revs.diffopt.flags.allow_textconv = 1;
-	setup_revisions(rev_argv.nr, rev_argv.v, &revs, NULL);
-	init_scoreboard(&sb);
-	sb.revs = &revs;
-	sb.repo = the_repository;
-	sb.path = path;
-	setup_scoreboard(&sb, &o);
-	o->suspects = blame_entry_prepend(NULL, 0, sb.num_lines, o);
-	prio_queue_put(&sb.commits, o->commit);
-	blame_origin_decref(o);
-	sb.ent = NULL;
-	sb.path = path;
-	assign_blame(&sb, 0);
-	blame_sort_final(&sb);
-	blame_coalesce(&sb);
+	partial = compute_blame(commit, path, oid, &ranges);
 
 	cgit_set_title_from_path(path);
 
@@ -174,13 +663,20 @@ static void print_object(const struct object_id *oid, const char *path,
 		goto cleanup;
 	}
 
+	if (partial)
+		html("<div class='blame-warning'>The blame was stopped after the "
+		     "time limit; follow the \"older than\" links to continue it "
+		     "for the remaining lines.</div>\n");
+
+	prepare_blamed_commits(&ranges, buf, size, &commits);
+
 	html("<table class='blame blob'>\n<tr>\n");
 
 	/* Commit hashes */
 	html("<td class='hashes'>");
-	for (ent = sb.ent; ent; ent = ent->next) {
+	for (i = 0; i < ranges.nr; i++) {
 		html("<div class='alt'><pre>");
-		emit_blame_entry_hash(ent);
+		emit_blame_entry_hash(&ranges.items[i], &commits);
 		html("</pre></div>");
 	}
 	html("</td>\n");
@@ -188,9 +684,10 @@ static void print_object(const struct object_id *oid, const char *path,
 	/* Line numbers */
 	if (ctx.cfg.enable_tree_linenumbers) {
 		html("<td class='linenumbers'>");
-		for (ent = sb.ent; ent; ent = ent->next) {
+		for (i = 0; i < ranges.nr; i++) {
 			html("<div class='alt'><pre>");
-			emit_blame_entry_linenumber(ent);
+			emit_blame_entry_linenumber(&ranges.items[i],
+						    &linenumbers);
 			html("</pre></div>");
 		}
 		html("</td>\n");
@@ -200,18 +697,13 @@ static void print_object(const struct object_id *oid, const char *path,
 
 	/* Colored bars behind lines */
 	html("<div>");
-	for (ent = sb.ent; ent; ) {
-		struct blame_entry *e = ent->next;
+	for (i = 0; i < ranges.nr; i++) {
 		html("<div class='alt'><pre>");
-		emit_blame_entry_line_background(&sb, ent);
+		emit_blame_entry_line_background(&ranges.items[i], &commits);
 		html("</pre></div>");
-		free(ent);
-		ent = e;
 	}
 	html("</div>");
 
-	free((void *)sb.final_buf);
-
 	/* Lines */
 	html("<pre><code>");
 	if (ctx.repo->source_filter) {
@@ -232,6 +724,9 @@ static void print_object(const struct object_id *oid, const char *path,
 	cgit_print_layout_end();
 
 cleanup:
+	clear_blamed_commits(&commits);
+	strbuf_release(&linenumbers);
+	free(ranges.items);
 	free(buf);
 }
 
@@ -246,7 +741,8 @@ static int walk_tree(const struct object_id *oid, struct strbuf *base,
 			strbuf_addbuf(&buffer, base);
 			strbuf_addstr(&buffer, pathname);
 			print_object(oid, buffer.buf, pathname,
-				     walk_tree_ctx->curr_rev);
+				     walk_tree_ctx->curr_rev,
+				     walk_tree_ctx->commit);
 			strbuf_release(&buffer);
 			walk_tree_ctx->state = 1;
 		} else if (S_ISDIR(mode)) {
@@ -302,6 +798,7 @@ void cgit_print_blame(void)
 	}
 
 	walk_tree_ctx.curr_rev = xstrdup(rev);
+	walk_tree_ctx.commit = commit;
 	walk_tree_ctx.match_baselen = (path_items.match) ?
 				       basedir_len(path_items.match) : -1;
 
@@ -14,20 +14,35 @@
 #include "html.h"
 #include "ui-shared.h"
 #include "packfile.h"
+#include "pkt-line.h"
+#include "run-command.h"
+#include "sigchain.h"
+#include <zlib.h>
 
 static int print_ref_info(const struct reference *ref, void *cb_data)
 {
-	struct object *obj;
+	struct object_id peeled;
+	enum object_type type;
 
-	if (!(obj = parse_object(the_repository, ref->oid)))
+	/* Only look up the type, and peel tags through the values recorded
+	 * by the ref backend where there are any, to avoid inflating every
+	 * commit and tag.
+	 */
+	type = odb_read_object_info(the_repository->objects, ref->oid, NULL);
+	if (type < 0)
 		return 0;
 
 	htmlf("%s\t%s\n", oid_to_hex(ref->oid), ref->name);
-	if (obj->type == OBJ_TAG) {
-		if (!(obj = deref_tag(the_repository, obj, ref->name, 0)))
-			return 0;
-		htmlf("%s\t%s^{}\n", oid_to_hex(&obj->oid), ref->name);
-	}
+	if (type == OBJ_TAG &&
+	    !reference_get_peeled_oid(the_repository, ref, &peeled))
+		htmlf("%s\t%s^{}\n", oid_to_hex(&peeled), ref->name);
+	return 0;
+}
+
+static int print_ref_infos(void *data)
+{
+	refs_for_each_ref(get_main_ref_store(the_repository),
+			  print_ref_info, NULL);
 	return 0;
 }
 
@@ -78,6 +93,147 @@ static void send_file(const char *path)
 	html_include(path);
 }
 
+static int is_protocol_v2(void)
+{
+	return ctx.env.http_git_protocol &&
+	       strstr(ctx.env.http_git_protocol, "version=2");
+}
+
+/* Prepare to run "git upload-pack --stateless-rpc" for the repository,
+ * with its output going straight to the client.
+ */
+static void prepare_upload_pack(struct child_process *cmd)
+{
+	cmd->git_cmd = 1;
+	strvec_pushl(&cmd->args, "upload-pack", "--stateless-rpc", NULL);
+	if (ctx.env.http_git_protocol)
+		strvec_pushf(&cmd->env, "GIT_PROTOCOL=%s",
+			     ctx.env.http_git_protocol);
+}
+
+/* Smart HTTP responses must not be kept by clients or proxies. */
+static void print_upload_pack_headers(const char *mimetype)
+{
+	ctx.page.mimetype = mimetype;
+	ctx.page.charset = NULL;
+	ctx.page.expires = ctx.page.modified;
+	/* As git http-backend does, so that proxies never reuse them. */
+	ctx.page.cache_control = "no-cache, max-age=0, must-revalidate";
+	cgit_print_http_headers();
+}
+
+static void print_upload_pack_advertisement(void)
+{
+	struct child_process cmd = CHILD_PROCESS_INIT;
+
+	print_upload_pack_headers("application/x-git-upload-pack-advertisement");
+	if (!is_protocol_v2()) {
+		packet_write_fmt(STDOUT_FILENO, "# service=git-upload-pack\n");
+		packet_flush(STDOUT_FILENO);
+	}
+	prepare_upload_pack(&cmd);
+	strvec_pushl(&cmd.args, "--advertise-refs", ctx.repo->path, NULL);
+	cmd.no_stdin = 1;
+	if (run_command(&cmd))
+		fprintf(stderr, "[cgit] upload-pack failed for %s\n",
+			ctx.repo->path);
+}
+
+/* Copy the request body to `fd`, inflating it if it was sent gzipped. The
+ * body is read up to CONTENT_LENGTH, or to the end if it is not given.
+ */
+static int copy_request_body(int fd)
+{
+	const char *encoding = ctx.env.http_content_encoding;
+	int gzipped = encoding && (!strcmp(encoding, "gzip") ||
+				   !strcmp(encoding, "x-gzip"));
+	size_t remaining = ctx.env.content_length;
+	unsigned char in[8192], out[65536];
+	z_stream stream;
+	int status = Z_OK, ret = 0;
+	ssize_t n;
+
+	memset(&stream, 0, sizeof(stream));
+	if (gzipped && inflateInit2(&stream, 16 + MAX_WBITS) != Z_OK)
+		return -1;
+	while (status != Z_STREAM_END) {
+		size_t len = sizeof(in);
+
+		if (ctx.env.content_length) {
+			if (!remaining)
+				break;
+			if (len > remaining)
+				len = remaining;
+		}
+		n = xread(STDIN_FILENO, in, len);
+		if (n <= 0) {
+			ret = n;
+			break;
+		}
+		remaining -= n;
+		if (!gzipped) {
+			if (write_in_full(fd, in, n) < 0) {
+				ret = -1;
+				break;
+			}
+			continue;
+		}
+		stream.next_in = in;
+		stream.avail_in = n;
+		do {
+			stream.next_out = out;
+			stream.avail_out = sizeof(out);
+			status = inflate(&stream, Z_NO_FLUSH);
+			if ((status != Z_OK && status != Z_STREAM_END) ||
+			    write_in_full(fd, out,
+					  sizeof(out) - stream.avail_out) < 0) {
+				ret = -1;
+				goto out;
+			}
+		} while (status != Z_STREAM_END &&
+			 (stream.avail_in || !stream.avail_out));
+	}
+out:
+	if (gzipped)
+		inflateEnd(&stream);
+	return ret;
+}
+
+void cgit_clone_upload_pack(void)
+{
+	struct child_process cmd = CHILD_PROCESS_INIT;
+
+	if (!ctx.cfg.enable_smart_http) {
+		cgit_print_error_page(404, "Not found", "Invalid request");
+		return;
+	}
+	if (!ctx.env.request_method || strcmp(ctx.env.request_method, "POST")) {
+		cgit_print_error_page(405, "Method not allowed",
+				      "Method not allowed");
+		return;
+	}
+
+	prepare_upload_pack(&cmd);
+	strvec_push(&cmd.args, ctx.repo->path);
+	cmd.in = -1;
+	if (start_command(&cmd)) {
+		fprintf(stderr, "[cgit] Failed to start upload-pack for %s\n",
+			ctx.repo->path);
+		cgit_print_error_page(500, "Internal server error",
+				      "Failed to start upload-pack");
+		return;
+	}
+	/* upload-pack only answers once it has read the request. */
+	print_upload_pack_headers("application/x-git-upload-pack-result");
+	sigchain_push(SIGPIPE, SIG_IGN);
+	if (copy_request_body(cmd.in))
+		fprintf(stderr, "[cgit] Failed to read upload-pack request for %s\n",
+			ctx.repo->path);
+	close(cmd.in);
+	sigchain_pop(SIGPIPE);
+	finish_command(&cmd);
+}
+
 void cgit_clone_info(void)
 {
 	if (!ctx.qry.path || strcmp(ctx.qry.path, "refs")) {
@@ -85,11 +241,23 @@ void cgit_clone_info(void)
 		return;
 	}
 
+	if (ctx.cfg.enable_smart_http && ctx.qry.service &&
+	    !strcmp(ctx.qry.service, "git-upload-pack")) {
+		print_upload_pack_advertisement();
+		return;
+	}
+
 	ctx.page.mimetype = "text/plain";
 	ctx.page.filename = "info/refs";
 	cgit_print_http_headers();
-	refs_for_each_ref(get_main_ref_store(the_repository),
-			  print_ref_info, NULL);
+	if (ctx.cfg.enable_fragment_cache) {
+		struct object_id state;
+
+		cgit_get_ref_state(&state);
+		cgit_print_fragment(fmt("info/refs %s", oid_to_hex(&state)),
+				    print_ref_infos, NULL);
+	} else
+		print_ref_infos(NULL);
 }
 
 void cgit_clone_objects(void)
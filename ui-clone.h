@@ -4,5 +4,6 @@
 void cgit_clone_info(void);
 void cgit_clone_objects(void);
 void cgit_clone_head(void);
+void cgit_clone_upload_pack(void);
 
 #endif /* UI_CLONE_H */
@@ -15,6 +15,19 @@
 #include "ui-diff.h"
 #include "ui-log.h"
 
+/* Unlike the rest of the header, the message never changes for a commit. */
+static int print_commit_msg(void *cbdata)
+{
+	struct commitinfo *info = cbdata;
+
+	html("<div class='commit-msg'>");
+	cgit_open_filter(ctx.repo->commit_filter);
+	html_txt(info->msg);
+	cgit_close_filter(ctx.repo->commit_filter);
+	html("</div>");
+	return 0;
+}
+
 void cgit_print_commit(char *hex, const char *prefix)
 {
 	struct commit *commit, *parent;
@@ -22,7 +35,7 @@ void cgit_print_commit(char *hex, const char *prefix)
 	struct commit_list *p;
 	struct strbuf notes = STRBUF_INIT;
 	struct object_id oid;
-	char *tmp, *tmp2;
+	char *tmp, *tmp2, *key;
 	int parents = 0;
 
 	if (!hex)
@@ -123,11 +136,10 @@ void cgit_print_commit(char *hex, const char *prefix)
 	cgit_close_filter(ctx.repo->commit_filter);
 	show_commit_decorations(commit);
 	html("</div>");
-	html("<div class='commit-msg'>");
-	cgit_open_filter(ctx.repo->commit_filter);
-	html_txt(info->msg);
-	cgit_close_filter(ctx.repo->commit_filter);
-	html("</div>");
+	key = xstrfmt("commit-msg %s %d", oid_to_hex(&commit->object.oid),
+		      ctx.repo->commit_filter != NULL);
+	cgit_print_fragment(key, print_commit_msg, info);
+	free(key);
 	if (notes.len != 0) {
 		html("<div class='notes-header'>Notes</div>");
 		html("<div class='notes'>");
@@ -40,6 +40,14 @@ static int use_ssdiff = 0;
 static struct diff_filepair *current_filepair;
 static const char *current_prefix;
 
+/* The links in a diff are made from the object ids alone, so that a
+ * cached diff does not depend on how the commits were named.
+ */
+static const char *old_rev_hex(void)
+{
+	return is_null_oid(old_rev_oid) ? NULL : oid_to_hex(old_rev_oid);
+}
+
 struct diff_filespec *cgit_get_current_old_file(void)
 {
 	return current_filepair->one;
@@ -99,8 +107,8 @@ static void print_fileinfo(struct fileinfo *info)
 		html("]</span>");
 	}
 	htmlf("</td><td class='%s'>", class);
-	cgit_diff_link(info->new_path, NULL, NULL, ctx.qry.head, ctx.qry.oid,
-		       ctx.qry.oid2, info->new_path);
+	cgit_diff_link(info->new_path, NULL, NULL, NULL,
+		       oid_to_hex(new_rev_oid), old_rev_hex(), info->new_path);
 	if (info->status == DIFF_STATUS_COPIED || info->status == DIFF_STATUS_RENAMED) {
 		htmlf(" (%s from ",
 		      info->status == DIFF_STATUS_COPIED ? "copied" : "renamed");
@@ -196,8 +204,8 @@ static void cgit_print_diffstat(const struct object_id *old_oid,
 	int i;
 
 	html("<div class='diffstat-header'>");
-	cgit_diff_link("Diffstat", NULL, NULL, ctx.qry.head, ctx.qry.oid,
-		       ctx.qry.oid2, NULL);
+	cgit_diff_link("Diffstat", NULL, NULL, NULL, oid_to_hex(new_rev_oid),
+		       old_rev_hex(), NULL);
 	if (prefix) {
 		html(" (limited to '");
 		html_txt(prefix);
@@ -215,6 +223,11 @@ static void cgit_print_diffstat(const struct object_id *old_oid,
 	htmlf("%d files changed, %d insertions, %d deletions",
 	      files, total_adds, total_rems);
 	html("</div>");
+	if (cgit_diff_rename_warning()) {
+		html("<div class='diffstat-warning'>");
+		html_txt(cgit_diff_rename_warning());
+		html("</div>");
+	}
 }
 
 
@@ -276,7 +289,7 @@ static void header(const struct object_id *oid1, char *path1, int mode1,
 		} else
 			html("<br/>--- a/");
 		if (mode1 != 0)
-			cgit_tree_link(path1, NULL, NULL, ctx.qry.head,
+			cgit_tree_link(path1, NULL, NULL, NULL,
 				       oid_to_hex(old_rev_oid), path1);
 		else
 			html_txt(path1);
@@ -286,7 +299,7 @@ static void header(const struct object_id *oid1, char *path1, int mode1,
 		} else
 			html("<br/>+++ b/");
 		if (mode2 != 0)
-			cgit_tree_link(path2, NULL, NULL, ctx.qry.head,
+			cgit_tree_link(path2, NULL, NULL, NULL,
 				       oid_to_hex(new_rev_oid), path2);
 		else
 			html_txt(path2);
@@ -383,12 +396,52 @@ void cgit_print_diff_ctrls(void)
 	html("</div>");
 }
 
+struct diff_content {
+	const char *prefix;
+	diff_type difftype;
+};
+
+static const char *str_or_empty(const char *str)
+{
+	return str ? str : "";
+}
+
+/*
+ * Print the diffstat and the diff itself. A diff cut short by the rename
+ * detection budget is not cached, since a later request can show the
+ * complete result.
+ */
+static int print_diff_content(void *cbdata)
+{
+	struct diff_content *data = cbdata;
+
+	cgit_print_diffstat(old_rev_oid, new_rev_oid, data->prefix);
+
+	if (data->difftype == DIFF_STATONLY)
+		return cgit_diff_rename_budget_exceeded();
+
+	if (use_ssdiff) {
+		html("<table summary='ssdiff' class='ssdiff'>");
+	} else {
+		html("<table summary='diff' class='diff'>");
+		html("<tr><td>");
+	}
+	cgit_diff_tree(old_rev_oid, new_rev_oid, filepair_cb, data->prefix,
+		       ctx.qry.ignorews);
+	if (!use_ssdiff)
+		html("</td></tr>");
+	html("</table>");
+	return cgit_diff_rename_budget_exceeded();
+}
+
 void cgit_print_diff(const char *new_rev, const char *old_rev,
 		     const char *prefix, int show_ctrls, int raw)
 {
 	struct commit *commit, *commit2;
 	const struct object_id *old_tree_oid, *new_tree_oid;
+	struct diff_content data;
 	diff_type difftype;
+	char *key;
 
 	/*
 	 * If "follow" is set then the diff machinery needs to examine the
@@ -481,23 +534,19 @@ void cgit_print_diff(const char *new_rev, const char *old_rev,
 	if (difftype == DIFF_STATONLY)
 		ctx.qry.difftype = ctx.cfg.difftype;
 
-	cgit_print_diffstat(old_rev_oid, new_rev_oid, prefix);
+	data.prefix = prefix;
+	data.difftype = difftype;
+	key = xstrfmt("diff %s %s %d %d %d %d %d %s %s",
+		      oid_to_hex(old_rev_oid), oid_to_hex(new_rev_oid),
+		      difftype, ctx.qry.difftype, ctx.qry.context,
+		      ctx.qry.ignorews, ctx.qry.follow,
+		      str_or_empty(current_prefix), str_or_empty(prefix));
+	cgit_print_fragment(key, print_diff_content, &data);
+	free(key);
 
 	if (difftype == DIFF_STATONLY)
 		return;
 
-	if (use_ssdiff) {
-		html("<table summary='ssdiff' class='ssdiff'>");
-	} else {
-		html("<table summary='diff' class='diff'>");
-		html("<tr><td>");
-	}
-	cgit_diff_tree(old_rev_oid, new_rev_oid, filepair_cb, prefix,
-		       ctx.qry.ignorews);
-	if (!use_ssdiff)
-		html("</td></tr>");
-	html("</table>");
-
 	if (show_ctrls)
 		cgit_print_layout_end();
 }
@@ -146,6 +146,19 @@ static int show_commit(struct commit *commit, struct rev_info *revs)
 	if (!parents)
 		return revs->show_root_diff;
 
+	/*
+	 * A commit which renames the file to the name we are following
+	 * adds that name, so if the changed-path filter says the current
+	 * name is untouched there is nothing to diff. The current name is
+	 * the one in the pathspec, which the revision walk moves to the old
+	 * name of the file at each rename; ctx.qry.vpath is only updated
+	 * when the renaming commit is shown.
+	 */
+	if (revs->diffopt.pathspec.nr == 1 &&
+	    !cgit_commit_may_change_path(commit,
+					 revs->diffopt.pathspec.items[0].match))
+		return 0;
+
 	/* When we get here we have precisely one parent. */
 	parent = parents->item;
 	/* If we can't parse the commit, let print_commit() report an error. */
@@ -430,6 +443,8 @@ void cgit_print_log(const char *tip, int ofs, int cnt, char *grep, char *pattern
 
 	if (path && ctx.qry.follow)
 		strvec_push(&rev_argv, "--follow");
+	if (path)
+		cgit_update_bloom_filters(tip);
 	strvec_push(&rev_argv, "--");
 	if (path)
 		strvec_push(&rev_argv, path);
@@ -12,12 +12,7 @@
 #include "ui-refs.h"
 #include "html.h"
 #include "ui-shared.h"
-
-static inline int cmp_age(int age1, int age2)
-{
-	/* age1 and age2 are assumed to be non-negative */
-	return age2 - age1;
-}
+#include "commit-graph.h"
 
 static int cmp_ref_name(const void *a, const void *b)
 {
@@ -27,33 +22,194 @@ static int cmp_ref_name(const void *a, const void *b)
 	return strcmp(r1->refname, r2->refname);
 }
 
-static int cmp_branch_age(const void *a, const void *b)
+/*
+ * A page of refs, with the dates of the commits or tags they point to.
+ * `heap` keeps the first `max` refs seen so far in the order of the list,
+ * with the last of them at the root; `count` is the number of refs seen.
+ * Refs are listed newest first, or by name if `by_name` is set; only
+ * those whose names contain `match` are counted.
+ */
+struct ref_date {
+	char *refname;
+	struct object_id oid;
+	timestamp_t date;
+};
+
+struct ref_selection {
+	struct ref_date *heap;
+	int nr;
+	int alloc;
+	int max;
+	int count;
+	int by_name;
+	const char *match;
+	const char *trim;
+};
+
+/* Look up the date of a ref, reading commits from the commit-graph. */
+static timestamp_t get_ref_date(const struct object_id *oid)
 {
-	struct refinfo *r1 = *(struct refinfo **)a;
-	struct refinfo *r2 = *(struct refinfo **)b;
+	struct commit *commit;
+	struct tag *tag;
+
+	commit = lookup_commit_in_graph(the_repository, oid);
+	if (commit)
+		return commit->date;
+
+	switch (odb_read_object_info(the_repository->objects, oid, NULL)) {
+	case OBJ_COMMIT:
+		commit = lookup_commit(the_repository, oid);
+		if (!commit || repo_parse_commit(the_repository, commit))
+			return 0;
+		return commit->date;
+	case OBJ_TAG:
+		tag = lookup_tag(the_repository, oid);
+		if (!tag || parse_tag(tag))
+			return 0;
+		return tag->date;
+	default:
+		return 0;
+	}
+}
 
-	return cmp_age(r1->commit->committer_date, r2->commit->committer_date);
+/* Newer refs come first, refs of the same age are ordered by name. */
+static int cmp_ref_date(const struct ref_date *r1, const struct ref_date *r2,
+			int by_name)
+{
+	if (!by_name && r1->date != r2->date)
+		return r1->date < r2->date ? 1 : -1;
+	return strcmp(r1->refname, r2->refname);
+}
+
+static int cmp_selected_ref(const void *a, const void *b, void *by_name)
+{
+	return cmp_ref_date(a, b, *(int *)by_name);
+}
+
+static void sift_up(struct ref_selection *sel, int i)
+{
+	struct ref_date *heap = sel->heap;
+	int parent;
+
+	while (i > 0) {
+		parent = (i - 1) / 2;
+		if (cmp_ref_date(&heap[i], &heap[parent], sel->by_name) <= 0)
+			break;
+		SWAP(heap[i], heap[parent]);
+		i = parent;
+	}
+}
+
+static void sift_down(struct ref_selection *sel, int i)
+{
+	struct ref_date *heap = sel->heap;
+	int child;
+
+	while ((child = 2 * i + 1) < sel->nr) {
+		if (child + 1 < sel->nr &&
+		    cmp_ref_date(&heap[child + 1], &heap[child], sel->by_name) > 0)
+			child++;
+		if (cmp_ref_date(&heap[child], &heap[i], sel->by_name) <= 0)
+			break;
+		SWAP(heap[i], heap[child]);
+		i = child;
+	}
 }
 
-static int get_ref_age(struct refinfo *ref)
+static int add_selected_ref(const struct reference *ref, void *cb_data)
 {
-	if (!ref->object)
+	struct ref_selection *sel = cb_data;
+	struct ref_date item;
+	const char *name = ref->name;
+
+	if (sel->trim && !skip_prefix(name, sel->trim, &name))
 		return 0;
-	switch (ref->object->type) {
-	case OBJ_TAG:
-		return ref->tag ? ref->tag->tagger_date : 0;
-	case OBJ_COMMIT:
-		return ref->commit ? ref->commit->committer_date : 0;
+	if (sel->match && !strstr(name, sel->match))
+		return 0;
+
+	sel->count++;
+	item.refname = (char *)name;
+	item.date = sel->by_name ? 0 : get_ref_date(ref->oid);
+
+	if (sel->nr < sel->max) {
+		ALLOC_GROW(sel->heap, sel->nr + 1, sel->alloc);
+		item.refname = xstrdup(name);
+		oidcpy(&item.oid, ref->oid);
+		sel->heap[sel->nr] = item;
+		sift_up(sel, sel->nr++);
+	} else if (cmp_ref_date(&item, &sel->heap[0], sel->by_name) < 0) {
+		free(sel->heap[0].refname);
+		item.refname = xstrdup(name);
+		oidcpy(&item.oid, ref->oid);
+		sel->heap[0] = item;
+		sift_down(sel, 0);
 	}
 	return 0;
 }
 
-static int cmp_tag_age(const void *a, const void *b)
+/*
+ * Iterate over the refs below `dir` whose names start with `prefix`,
+ * relying on the ref backend to skip the others.
+ */
+static void select_refs(struct ref_selection *sel, const char *dir,
+			const char *prefix)
 {
-	struct refinfo *r1 = *(struct refinfo **)a;
-	struct refinfo *r2 = *(struct refinfo **)b;
+	struct strbuf fullprefix = STRBUF_INIT;
+
+	strbuf_addf(&fullprefix, "%s%s", dir, prefix);
+	sel->trim = dir;
+	refs_for_each_fullref_in(get_main_ref_store(the_repository),
+				 fullprefix.buf, NULL, add_selected_ref, sel);
+	strbuf_release(&fullprefix);
+}
+
+/*
+ * Move the selected refs after the first `ofs` ones to `list`. Only these
+ * refs get their commits and tags parsed in full.
+ */
+static void get_selected_refs(struct ref_selection *sel, int ofs,
+			      struct reflist *list)
+{
+	int i;
+
+	QSORT_S(sel->heap, sel->nr, cmp_selected_ref, &sel->by_name);
+	for (i = 0; i < sel->nr; i++) {
+		if (i >= ofs)
+			cgit_add_ref(list, cgit_mk_refinfo(sel->heap[i].refname,
+							   &sel->heap[i].oid));
+		free(sel->heap[i].refname);
+	}
+	free(sel->heap);
+}
+
+/*
+ * Fill `list` with up to `count` branches after the first `ofs` ones, of
+ * those starting with `prefix` and containing `match`. Returns the number
+ * of these branches.
+ */
+static int get_branches(struct reflist *list, const char *prefix,
+			const char *match, int ofs, int count, int by_name)
+{
+	struct ref_selection sel = { .by_name = by_name, .match = match };
+
+	sel.max = count > 0 && ofs < INT_MAX - count ? ofs + count : INT_MAX;
+	select_refs(&sel, "refs/heads/", prefix);
+	if (ctx.repo->enable_remote_branches)
+		select_refs(&sel, "refs/remotes/", prefix);
+	get_selected_refs(&sel, ofs, list);
+	return sel.count;
+}
+
+/* Like get_branches(), but for tags, which are always listed by age. */
+static int get_tags(struct reflist *list, const char *prefix,
+		    const char *match, int ofs, int count)
+{
+	struct ref_selection sel = { .match = match };
 
-	return cmp_age(get_ref_age(r1), get_ref_age(r2));
+	sel.max = count > 0 && ofs < INT_MAX - count ? ofs + count : INT_MAX;
+	select_refs(&sel, "refs/tags/", prefix);
+	get_selected_refs(&sel, ofs, list);
+	return sel.count;
 }
 
 static int print_branch(struct refinfo *ref)
@@ -138,42 +294,39 @@ static int print_tag(struct refinfo *ref)
 	return 0;
 }
 
+static void print_branch_header(void)
+{
+	html("<tr class='nohover'><th class='left'>Branch</th>"
+	     "<th class='left'>Commit message</th>"
+	     "<th class='left'>Author</th>"
+	     "<th class='left' colspan='2'>Age</th></tr>\n");
+}
+
 static void print_refs_link(const char *path)
 {
 	html("<tr class='nohover'><td colspan='5'>");
-	cgit_refs_link("[...]", NULL, NULL, ctx.qry.head, NULL, path);
+	cgit_refs_search_link("[...]", NULL, NULL, ctx.qry.head, path,
+			      ctx.qry.search, 0);
 	html("</td></tr>");
 }
 
 void cgit_print_branches(int maxcount)
 {
 	struct reflist list;
-	int i;
+	int i, total;
 
-	html("<tr class='nohover'><th class='left'>Branch</th>"
-	     "<th class='left'>Commit message</th>"
-	     "<th class='left'>Author</th>"
-	     "<th class='left' colspan='2'>Age</th></tr>\n");
+	print_branch_header();
 
 	list.refs = NULL;
 	list.alloc = list.count = 0;
-	refs_for_each_branch_ref(get_main_ref_store(the_repository),
-				 cgit_refs_cb, &list);
-	if (ctx.repo->enable_remote_branches)
-		refs_for_each_remote_ref(get_main_ref_store(the_repository),
-					 cgit_refs_cb, &list);
-
-	if (maxcount == 0 || maxcount > list.count)
-		maxcount = list.count;
-
-	qsort(list.refs, list.count, sizeof(*list.refs), cmp_branch_age);
+	total = get_branches(&list, "", NULL, 0, maxcount, 0);
 	if (ctx.repo->branch_sort == 0)
-		qsort(list.refs, maxcount, sizeof(*list.refs), cmp_ref_name);
+		qsort(list.refs, list.count, sizeof(*list.refs), cmp_ref_name);
 
-	for (i = 0; i < maxcount; i++)
+	for (i = 0; i < list.count; i++)
 		print_branch(list.refs[i]);
 
-	if (maxcount < list.count)
+	if (list.count < total)
 		print_refs_link("heads");
 
 	cgit_free_reflist_inner(&list);
@@ -182,43 +335,150 @@ void cgit_print_branches(int maxcount)
 void cgit_print_tags(int maxcount)
 {
 	struct reflist list;
-	int i;
+	int i, total;
 
 	list.refs = NULL;
 	list.alloc = list.count = 0;
-	refs_for_each_tag_ref(get_main_ref_store(the_repository),
-			      cgit_refs_cb, &list);
+	total = get_tags(&list, "", NULL, 0, maxcount);
 	if (list.count == 0)
 		return;
-	qsort(list.refs, list.count, sizeof(*list.refs), cmp_tag_age);
-	if (!maxcount)
-		maxcount = list.count;
-	else if (maxcount > list.count)
-		maxcount = list.count;
 	print_tag_header();
-	for (i = 0; i < maxcount; i++)
+	for (i = 0; i < list.count; i++)
 		print_tag(list.refs[i]);
 
-	if (maxcount < list.count)
+	if (list.count < total)
 		print_refs_link("tags");
 
 	cgit_free_reflist_inner(&list);
 }
 
+static void print_refs_filter(const char *path)
+{
+	html("<tr class='nohover'><td colspan='5'>");
+	html("<form method='get' action='");
+	if (ctx.cfg.virtual_root) {
+		char *fileurl = cgit_fileurl(ctx.qry.repo, "refs", path, NULL);
+		html_url_path(fileurl);
+		free(fileurl);
+	}
+	html("'>\n");
+	if (!ctx.cfg.virtual_root) {
+		struct strbuf url = STRBUF_INIT;
+
+		strbuf_addf(&url, "%s/refs/%s", ctx.qry.repo, path);
+		html_hidden("url", url.buf);
+		strbuf_release(&url);
+	}
+	if (ctx.qry.head && ctx.repo->defbranch &&
+	    strcmp(ctx.qry.head, ctx.repo->defbranch))
+		html_hidden("h", ctx.qry.head);
+	html("<input type='search' name='q' size='20' value='");
+	html_attr(ctx.qry.search);
+	html("'/>\n");
+	html("<input type='submit' value='filter'/>\n");
+	html("</form></td></tr>\n");
+}
+
+static void print_refs_pager(const char *path, int ofs, int count, int total)
+{
+	if (ofs == 0 && total <= count)
+		return;
+	html("<ul class='pager'>");
+	if (ofs > 0) {
+		html("<li>");
+		cgit_refs_search_link("[prev]", NULL, NULL, ctx.qry.head, path,
+				      ctx.qry.search, ofs - count);
+		html("</li>");
+	}
+	if (total - ofs > count) {
+		html("<li>");
+		cgit_refs_search_link("[next]", NULL, NULL, ctx.qry.head, path,
+				      ctx.qry.search, ofs + count);
+		html("</li>");
+	}
+	html("</ul>");
+}
+
+/*
+ * Print one page of the branches or tags, as selected by `path`: "heads"
+ * or "tags", optionally followed by a slash and the prefix the refs must
+ * start with.
+ */
+static void print_refs_page(const char *path)
+{
+	struct reflist list;
+	const char *prefix;
+	int i, total, ofs, count;
+
+	ofs = ctx.qry.ofs > 0 ? ctx.qry.ofs : 0;
+	count = ctx.cfg.max_ref_count;
+	list.refs = NULL;
+	list.alloc = list.count = 0;
+
+	html("<table class='list nowrap'>");
+	print_refs_filter(path);
+	if (skip_prefix(path, "heads", &prefix)) {
+		skip_prefix(prefix, "/", &prefix);
+		print_branch_header();
+		total = get_branches(&list, prefix, ctx.qry.search, ofs, count,
+				     ctx.repo->branch_sort == 0);
+		for (i = 0; i < list.count; i++)
+			print_branch(list.refs[i]);
+	} else {
+		skip_prefix(path, "tags", &prefix);
+		skip_prefix(prefix, "/", &prefix);
+		print_tag_header();
+		total = get_tags(&list, prefix, ctx.qry.search, ofs, count);
+		for (i = 0; i < list.count; i++)
+			print_tag(list.refs[i]);
+	}
+	html("</table>");
+	print_refs_pager(path, ofs, count, total);
+
+	cgit_free_reflist_inner(&list);
+}
+
 void cgit_print_refs(void)
 {
 	cgit_print_layout_start();
-	html("<table class='list nowrap'>");
 
-	if (ctx.qry.path && starts_with(ctx.qry.path, "heads"))
-		cgit_print_branches(0);
-	else if (ctx.qry.path && starts_with(ctx.qry.path, "tags"))
-		cgit_print_tags(0);
-	else {
-		cgit_print_branches(0);
+	if (ctx.qry.path && (starts_with(ctx.qry.path, "heads") ||
+			     starts_with(ctx.qry.path, "tags"))) {
+		print_refs_page(ctx.qry.path);
+	} else {
+		struct reflist list;
+		int i, total;
+
+		html("<table class='list nowrap'>");
+		print_refs_filter("");
+
+		list.refs = NULL;
+		list.alloc = list.count = 0;
+		print_branch_header();
+		total = get_branches(&list, "", ctx.qry.search, 0,
+				     ctx.cfg.max_ref_count,
+				     ctx.repo->branch_sort == 0);
+		for (i = 0; i < list.count; i++)
+			print_branch(list.refs[i]);
+		if (list.count < total)
+			print_refs_link("heads");
+		cgit_free_reflist_inner(&list);
+
 		html("<tr class='nohover'><td colspan='5'>&nbsp;</td></tr>");
-		cgit_print_tags(0);
+
+		list.refs = NULL;
+		list.alloc = list.count = 0;
+		total = get_tags(&list, "", ctx.qry.search, 0,
+				 ctx.cfg.max_ref_count);
+		if (list.count)
+			print_tag_header();
+		for (i = 0; i < list.count; i++)
+			print_tag(list.refs[i]);
+		if (list.count < total)
+			print_refs_link("tags");
+		cgit_free_reflist_inner(&list);
+
+		html("</table>");
 	}
-	html("</table>");
 	cgit_print_layout_end();
 }
@@ -9,76 +9,13 @@
 #include "cgit.h"
 #include "ui-repolist.h"
 #include "html.h"
+#include "repolist-index.h"
 #include "ui-shared.h"
 
-static time_t read_agefile(const char *path)
-{
-	time_t result;
-	size_t size;
-	char *buf = NULL;
-	struct strbuf date_buf = STRBUF_INIT;
-
-	if (readfile(path, &buf, &size)) {
-		free(buf);
-		return 0;
-	}
-
-	if (parse_date(buf, &date_buf) == 0)
-		result = strtoul(date_buf.buf, NULL, 10);
-	else
-		result = 0;
-	free(buf);
-	strbuf_release(&date_buf);
-	return result;
-}
-
-static int get_repo_modtime(const struct cgit_repo *repo, time_t *mtime)
-{
-	struct strbuf path = STRBUF_INIT;
-	struct stat s;
-	struct cgit_repo *r = (struct cgit_repo *)repo;
-
-	if (repo->mtime != -1) {
-		*mtime = repo->mtime;
-		return 1;
-	}
-	strbuf_addf(&path, "%s/%s", repo->path, ctx.cfg.agefile);
-	if (stat(path.buf, &s) == 0) {
-		*mtime = read_agefile(path.buf);
-		if (*mtime) {
-			r->mtime = *mtime;
-			goto end;
-		}
-	}
-
-	strbuf_reset(&path);
-	strbuf_addf(&path, "%s/refs/heads/%s", repo->path,
-		    repo->defbranch ? repo->defbranch : "master");
-	if (stat(path.buf, &s) == 0) {
-		*mtime = s.st_mtime;
-		r->mtime = *mtime;
-		goto end;
-	}
-
-	strbuf_reset(&path);
-	strbuf_addf(&path, "%s/%s", repo->path, "packed-refs");
-	if (stat(path.buf, &s) == 0) {
-		*mtime = s.st_mtime;
-		r->mtime = *mtime;
-		goto end;
-	}
-
-	*mtime = 0;
-	r->mtime = *mtime;
-end:
-	strbuf_release(&path);
-	return (r->mtime != 0);
-}
-
 static void print_modtime(struct cgit_repo *repo)
 {
 	time_t t;
-	if (get_repo_modtime(repo, &t))
+	if (cgit_get_repo_modtime(repo, &t))
 		cgit_print_age(t, 0, -1);
 }
 
@@ -110,20 +47,7 @@ static int is_visible(struct cgit_repo *repo)
 {
 	if (repo->hide || repo->ignore)
 		return 0;
-	if (!(is_match(repo) && is_in_url(repo)))
-		return 0;
-	return 1;
-}
-
-static int any_repos_visible(void)
-{
-	int i;
-
-	for (i = 0; i < cgit_repolist.count; i++) {
-		if (is_visible(&cgit_repolist.repos[i]))
-			return 1;
-	}
-	return 0;
+	return is_in_url(repo);
 }
 
 static void print_sort_header(const char *title, const char *sort)
@@ -186,50 +110,54 @@ static int cmp(const char *s1, const char *s2)
 
 static int sort_name(const void *a, const void *b)
 {
-	const struct cgit_repo *r1 = a;
-	const struct cgit_repo *r2 = b;
+	const struct cgit_repo *r1 = *(struct cgit_repo * const *)a;
+	const struct cgit_repo *r2 = *(struct cgit_repo * const *)b;
 
 	return cmp(r1->name, r2->name);
 }
 
 static int sort_desc(const void *a, const void *b)
 {
-	const struct cgit_repo *r1 = a;
-	const struct cgit_repo *r2 = b;
+	const struct cgit_repo *r1 = *(struct cgit_repo * const *)a;
+	const struct cgit_repo *r2 = *(struct cgit_repo * const *)b;
 
 	return cmp(r1->desc, r2->desc);
 }
 
 static int sort_owner(const void *a, const void *b)
 {
-	const struct cgit_repo *r1 = a;
-	const struct cgit_repo *r2 = b;
+	const struct cgit_repo *r1 = *(struct cgit_repo * const *)a;
+	const struct cgit_repo *r2 = *(struct cgit_repo * const *)b;
 
 	return cmp(r1->owner, r2->owner);
 }
 
-static int sort_idle(const void *a, const void *b)
+static int cmp_idle(const struct cgit_repo *r1, const struct cgit_repo *r2)
 {
-	const struct cgit_repo *r1 = a;
-	const struct cgit_repo *r2 = b;
 	time_t t1, t2;
 
 	t1 = t2 = 0;
-	get_repo_modtime(r1, &t1);
-	get_repo_modtime(r2, &t2);
+	cgit_get_repo_modtime(r1, &t1);
+	cgit_get_repo_modtime(r2, &t2);
 	return t2 - t1;
 }
 
+static int sort_idle(const void *a, const void *b)
+{
+	return cmp_idle(*(struct cgit_repo * const *)a,
+			*(struct cgit_repo * const *)b);
+}
+
 static int sort_section(const void *a, const void *b)
 {
-	const struct cgit_repo *r1 = a;
-	const struct cgit_repo *r2 = b;
+	const struct cgit_repo *r1 = *(struct cgit_repo * const *)a;
+	const struct cgit_repo *r2 = *(struct cgit_repo * const *)b;
 	int result;
 
 	result = cmp(r1->section, r2->section);
 	if (!result) {
 		if (!strcmp(ctx.cfg.repository_sort, "age"))
-			result = sort_idle(r1, r2);
+			result = cmp_idle(r1, r2);
 		if (!result)
 			result = cmp(r1->name, r2->name);
 	}
@@ -250,31 +178,110 @@ static const struct sortcolumn sortcolumn[] = {
 	{NULL, NULL}
 };
 
-static int sort_repolist(char *field)
+/* The visible repositories on the current page of the index. */
+struct repolist_page {
+	struct cgit_repo **repos;
+	int nr;
+	int total;	/* number of visible repositories on all pages */
+};
+
+static void add_visible_repo(struct repolist_page *page,
+			     struct cgit_repo *repo)
+{
+	if (page->total >= ctx.qry.ofs &&
+	    page->total - ctx.qry.ofs < ctx.cfg.max_repo_count)
+		page->repos[page->nr++] = repo;
+	page->total++;
+}
+
+/*
+ * Fill `page` with the visible repositories from offset ctx.qry.ofs on,
+ * sorted by the column `field`, or in the order of the repolist if there
+ * is no such column. The sort orders of a cached repolist are used when
+ * they are available. Only the repositories of the page are kept; the
+ * others are merely counted, unless the sort order already holds just
+ * the visible ones. Returns 1 if the repositories were sorted.
+ */
+static int get_repolist_page(struct repolist_page *page, const char *field)
 {
 	const struct sortcolumn *column;
+	struct cgit_repo **visible = NULL;
+	char *match = NULL;
+	int *order = NULL;
+	int i, nr = 0, count = cgit_repolist.count;
 
 	for (column = &sortcolumn[0]; column->name; column++) {
-		if (strcmp(field, column->name))
+		if (field && !strcmp(field, column->name))
+			break;
+	}
+	if (!column->name)
+		column = NULL;
+
+	if (ctx.qry.search) {
+		match = xmalloc(cgit_repolist.count);
+		cgit_search_repolist(ctx.qry.search, match, is_match);
+	}
+	ALLOC_ARRAY(page->repos, cgit_repolist.count < ctx.cfg.max_repo_count ?
+				 cgit_repolist.count : ctx.cfg.max_repo_count);
+	page->nr = page->total = 0;
+	order = cgit_get_repolist_order(column ? column->name : NULL, &count);
+	if (order && !match && (!ctx.qry.url || !*ctx.qry.url)) {
+		for (i = ctx.qry.ofs > 0 ? ctx.qry.ofs : 0;
+		     i < count && i - ctx.qry.ofs < ctx.cfg.max_repo_count; i++)
+			page->repos[page->nr++] = &cgit_repolist.repos[order[i]];
+		page->total = count;
+		goto out;
+	}
+	if (column && !order)
+		ALLOC_ARRAY(visible, cgit_repolist.count);
+	for (i = 0; i < count; i++) {
+		int pos = order ? order[i] : i;
+		struct cgit_repo *repo = &cgit_repolist.repos[pos];
+
+		if ((match && !match[pos]) || !is_visible(repo))
 			continue;
-		qsort(cgit_repolist.repos, cgit_repolist.count,
-			sizeof(struct cgit_repo), column->fn);
-		return 1;
+		if (visible)
+			visible[nr++] = repo;
+		else
+			add_visible_repo(page, repo);
 	}
-	return 0;
+	if (visible) {
+		qsort(visible, nr, sizeof(*visible), column->fn);
+		for (i = 0; i < nr; i++)
+			add_visible_repo(page, visible[i]);
+	}
+out:
+	free(visible);
+	free(order);
+	free(match);
+	return column != NULL;
 }
 
+/* Get the current page of the index, returning 1 if it was sorted by the
+ * sort query.
+ */
+static int get_index_page(struct repolist_page *page)
+{
+	cgit_load_repolist_idle();
+	if (ctx.qry.sort)
+		return get_repolist_page(page, ctx.qry.sort);
+	get_repolist_page(page, ctx.cfg.section_sort ? "section" : NULL);
+	return 0;
+}
 
 void cgit_print_repolist(void)
 {
-	int i, columns = 3, hits = 0, header = 0;
+	int i, columns = 3, header = 0;
 	char *last_section = NULL;
 	char *section;
 	char *repourl;
-	int sorted = 0;
+	int sorted;
+	struct repolist_page page;
 
-	if (!any_repos_visible()) {
+	sorted = get_index_page(&page);
+	if (!page.total) {
 		cgit_print_error_page(404, "Not found", "No repositories found");
+		free(page.repos);
 		return;
 	}
 
@@ -288,21 +295,9 @@ void cgit_print_repolist(void)
 	cgit_print_docstart();
 	cgit_print_pageheader();
 
-	if (ctx.qry.sort)
-		sorted = sort_repolist(ctx.qry.sort);
-	else if (ctx.cfg.section_sort)
-		sort_repolist("section");
-
 	html("<table summary='repository list' class='list nowrap'>");
-	for (i = 0; i < cgit_repolist.count; i++) {
-		ctx.repo = &cgit_repolist.repos[i];
-		if (!is_visible(ctx.repo))
-			continue;
-		hits++;
-		if (hits <= ctx.qry.ofs)
-			continue;
-		if (hits > ctx.qry.ofs + ctx.cfg.max_repo_count)
-			continue;
+	for (i = 0; i < page.nr; i++) {
+		ctx.repo = page.repos[i];
 		if (!header++)
 			print_header();
 		section = ctx.repo->section;
@@ -361,9 +356,45 @@ void cgit_print_repolist(void)
 		html("</tr>\n");
 	}
 	html("</table>");
-	if (hits > ctx.cfg.max_repo_count)
-		print_pager(hits, ctx.cfg.max_repo_count, ctx.qry.search, ctx.qry.sort);
+	if (page.total > ctx.cfg.max_repo_count)
+		print_pager(page.total, ctx.cfg.max_repo_count, ctx.qry.search,
+			    ctx.qry.sort);
 	cgit_print_docend();
+	free(page.repos);
+}
+
+void cgit_print_repolist_json(void)
+{
+	struct repolist_page page;
+	struct cgit_repo *repo;
+	time_t t;
+	int i;
+
+	get_index_page(&page);
+	ctx.page.mimetype = "application/x-ndjson";
+	cgit_print_http_headers();
+	for (i = 0; i < page.nr; i++) {
+		repo = page.repos[i];
+		html("{\"url\":");
+		html_json_string(repo->url);
+		html(",\"name\":");
+		html_json_string(repo->name);
+		html(",\"desc\":");
+		html_json_string(repo->desc);
+		if (ctx.cfg.enable_index_owner) {
+			html(",\"owner\":");
+			html_json_string(repo->owner);
+		}
+		html(",\"section\":");
+		html_json_string(repo->section);
+		html(",\"modified\":");
+		if (cgit_get_repo_modtime(repo, &t))
+			htmlf("%"PRIuMAX, (uintmax_t)t);
+		else
+			html("null");
+		html("}\n");
+	}
+	free(page.repos);
 }
 
 void cgit_print_site_readme(void)
@@ -2,6 +2,7 @@
 #define UI_REPOLIST_H
 
 extern void cgit_print_repolist(void);
+extern void cgit_print_repolist_json(void);
 extern void cgit_print_site_readme(void);
 
 #endif /* UI_REPOLIST_H */
@@ -10,6 +10,7 @@
 
 #include "cgit.h"
 #include "ui-shared.h"
+#include "cache.h"
 #include "cmd.h"
 #include "html.h"
 #include "version.h"
@@ -453,6 +454,29 @@ void cgit_refs_link(const char *name, const char *title, const char *class,
 	reporevlink("refs", name, title, class, head, rev, path);
 }
 
+void cgit_refs_search_link(const char *name, const char *title,
+			   const char *class, const char *head,
+			   const char *path, const char *pattern, int ofs)
+{
+	char *delim;
+
+	delim = repolink(title, class, "refs", head, path);
+	if (pattern) {
+		html(delim);
+		html("q=");
+		html_url_arg(pattern);
+		delim = "&amp;";
+	}
+	if (ofs > 0) {
+		html(delim);
+		html("ofs=");
+		htmlf("%d", ofs);
+	}
+	html("'>");
+	html_txt(name);
+	html("</a>");
+}
+
 void cgit_snapshot_link(const char *name, const char *title, const char *class,
 			const char *head, const char *rev,
 			const char *archivename)
@@ -742,7 +766,9 @@ void cgit_print_http_headers(void)
 		html_header_arg_in_quotes(ctx.page.filename);
 		html("\"\n");
 	}
-	if (!ctx.env.authenticated)
+	if (ctx.page.cache_control)
+		htmlf("Cache-Control: %s\n", ctx.page.cache_control);
+	else if (!ctx.env.authenticated)
 		html("Cache-Control: no-cache, no-store\n");
 	htmlf("Last-Modified: %s\n", http_date(ctx.page.modified));
 	htmlf("Expires: %s\n", http_date(ctx.page.expires));
@@ -916,6 +942,24 @@ void cgit_print_layout_end(void)
 	cgit_print_docend();
 }
 
+/* Print a part of a page which is determined by the objects and options
+ * named in `key`, from the fragment cache if it is enabled.
+ */
+void cgit_print_fragment(const char *key, cache_fragment_fn fn, void *data)
+{
+	char *fullkey;
+
+	if (!ctx.cfg.enable_fragment_cache) {
+		fn(data);
+		return;
+	}
+	fullkey = xstrfmt("%s %s", ctx.repo->url, key);
+	cache_fragment(ctx.cfg.cache_size,
+		       fmt("%s/fragments", ctx.cfg.cache_root), fullkey,
+		       ctx.cfg.cache_static_ttl, fn, data);
+	free(fullkey);
+}
+
 static void add_clone_urls(void (*fn)(const char *), char *txt, char *suffix)
 {
 	struct strbuf **url_list = strbuf_split_str(txt, ' ', 0);
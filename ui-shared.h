@@ -43,6 +43,10 @@ extern void cgit_patch_link(const char *name, const char *title,
 extern void cgit_refs_link(const char *name, const char *title,
 			   const char *class, const char *head,
 			   const char *rev, const char *path);
+extern void cgit_refs_search_link(const char *name, const char *title,
+				  const char *class, const char *head,
+				  const char *path, const char *pattern,
+				  int ofs);
 extern void cgit_snapshot_link(const char *name, const char *title,
 			       const char *class, const char *head,
 			       const char *rev, const char *archivename);
@@ -60,6 +64,8 @@ extern void cgit_submodule_link(const char *class, char *path,
 
 extern void cgit_print_layout_start(void);
 extern void cgit_print_layout_end(void);
+extern void cgit_print_fragment(const char *key,
+				int (*fn)(void *data), void *data);
 
 __attribute__((format (printf,1,2)))
 extern void cgit_print_error(const char *fmt, ...);
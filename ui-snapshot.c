@@ -12,6 +12,10 @@
 #include "ui-snapshot.h"
 #include "html.h"
 #include "ui-shared.h"
+#include "cache.h"
+#include "copy.h"
+#include "thread-utils.h"
+#include <zlib.h>
 
 static int write_archive_type(const char *format, const char *hex, const char *prefix)
 {
@@ -50,28 +54,316 @@ static int write_tar_archive(const char *hex, const char *prefix)
 	return write_archive_type("--format=tar", hex, prefix);
 }
 
+/* Zip archives compress each file on its own, so they are not made from
+ * the staged tar like the compressed tar formats.
+ */
 static int write_zip_archive(const char *hex, const char *prefix)
 {
 	return write_archive_type("--format=zip", hex, prefix);
 }
 
+static char *snapshot_cache_path(void)
+{
+	return fmt("%s/snapshots", ctx.cfg.cache_root);
+}
+
+/* Archives are stored by commit (`hex`), prefix and format. */
+static char *snapshot_name(const char *hex, const char *prefix,
+			   const char *suffix)
+{
+	return xstrfmt("%s-%08lx%s", hex, hash_str(prefix), suffix);
+}
+
+static char *snapshot_key(const char *hex, const char *prefix,
+			  const char *suffix)
+{
+	return xstrfmt("%s %s%s", hex, prefix, suffix);
+}
+
+struct staged_tar {
+	const char *hex;
+	const char *prefix;
+};
+
+static int stage_tar(void *cbdata)
+{
+	struct staged_tar *tar = cbdata;
+
+	return write_tar_archive(tar->hex, tar->prefix) != 0;
+}
+
+/*
+ * With enable-snapshot-staging, the compressed formats are made from the
+ * uncompressed tar in the snapshot store, which is written first if
+ * needed. Returns a file descriptor to read it from, or -1 if the tar
+ * has to be written from the repository.
+ */
+static int open_staged_tar(const char *hex, const char *prefix)
+{
+	struct staged_tar tar = { hex, prefix };
+	char *path, *name, *key;
+	int fd;
+
+	if (!ctx.cfg.enable_snapshot_staging || ctx.cfg.snapshot_cache_size <= 0)
+		return -1;
+	path = xstrdup(snapshot_cache_path());
+	name = snapshot_name(hex, prefix, ".tar");
+	key = snapshot_key(hex, prefix, ".tar");
+	fd = cache_file_open(path, name, key,
+			     (off_t)ctx.cfg.snapshot_cache_size << 20,
+			     stage_tar, &tar);
+	free(key);
+	free(name);
+	free(path);
+	return fd;
+}
+
+static int write_staged_tar_archive(int staged, const char *hex,
+				    const char *prefix)
+{
+	int rv;
+
+	if (staged < 0)
+		return write_tar_archive(hex, prefix);
+	rv = copy_fd(staged, STDOUT_FILENO);
+	close(staged);
+	return rv;
+}
+
 static int write_compressed_tar_archive(const char *hex,
 					const char *prefix,
 					char *filter_argv[])
 {
-	int rv;
+	int rv, staged;
 	struct cgit_exec_filter f;
 	cgit_exec_filter_init(&f, filter_argv[0], filter_argv);
 
+	staged = open_staged_tar(hex, prefix);
 	cgit_open_filter(&f.base);
-	rv = write_tar_archive(hex, prefix);
-	cgit_close_filter(&f.base);
+	rv = write_staged_tar_archive(staged, hex, prefix);
+	rv |= cgit_close_filter(&f.base);
 	return rv;
 }
 
+/*
+ * Parallel gzip compression, in the way of pigz: the tar stream is split
+ * into blocks which are deflated by separate threads, each primed with
+ * the end of the previous block as dictionary. Flushing each block to a
+ * byte boundary lets the results be concatenated to a single deflate
+ * stream.
+ *
+ * The threads must not die(), as that would exit the process under the
+ * main thread's feet: they report failures in `failed` and `status`,
+ * and the main thread fails the snapshot.
+ */
+#define GZIP_BLOCK_SIZE (128 * 1024)
+#define GZIP_WINDOW_SIZE (32 * 1024)
+
+struct gzip_block {
+	unsigned char *in;
+	size_t in_len;
+	const unsigned char *dict;
+	size_t dict_len;
+	unsigned char *out;
+	size_t out_len;
+	uLong crc;
+	pthread_t thread;
+	int threaded;
+	int failed;
+};
+
+struct parallel_gzip {
+	int in;
+	int out;
+	int threads;
+	int status;
+	pthread_t thread;
+};
+
+static void *deflate_block(void *data)
+{
+	struct gzip_block *block = data;
+	z_stream zs;
+	unsigned char *out;
+	size_t size;
+
+	memset(&zs, 0, sizeof(zs));
+	if (deflateInit2(&zs, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -15, 8,
+			 Z_DEFAULT_STRATEGY) != Z_OK) {
+		block->failed = 1;
+		return NULL;
+	}
+	if (block->dict_len)
+		deflateSetDictionary(&zs, block->dict, block->dict_len);
+
+	size = deflateBound(&zs, block->in_len) + 64;
+	block->out = malloc(size);
+	if (!block->out)
+		goto fail;
+	zs.next_in = block->in;
+	zs.avail_in = block->in_len;
+	zs.next_out = block->out;
+	zs.avail_out = size;
+	while (deflate(&zs, Z_SYNC_FLUSH) == Z_OK && !zs.avail_out) {
+		out = realloc(block->out, size * 2);
+		if (!out)
+			goto fail;
+		block->out = out;
+		zs.next_out = block->out + size;
+		zs.avail_out = size;
+		size *= 2;
+	}
+	block->out_len = zs.next_out - block->out;
+	deflateEnd(&zs);
+
+	block->crc = crc32(0, block->in, block->in_len);
+	return NULL;
+
+fail:
+	deflateEnd(&zs);
+	block->failed = 1;
+	return NULL;
+}
+
+static void *run_parallel_gzip(void *data)
+{
+	/* No file name and no time stamp, like "gzip -n". */
+	static const unsigned char header[] = {
+		0x1f, 0x8b, 8, 0, 0, 0, 0, 0, 0, 3
+	};
+	/* An empty final block with fixed codes. */
+	static const unsigned char last_block[] = { 3, 0 };
+	struct parallel_gzip *gz = data;
+	struct gzip_block *blocks;
+	unsigned char window[GZIP_WINDOW_SIZE], trailer[8];
+	size_t window_len = 0;
+	uLong crc = crc32(0, NULL, 0);
+	uint32_t total = 0;
+	ssize_t len;
+	int i, nr, eof = 0;
+
+	blocks = calloc(gz->threads, sizeof(*blocks));
+	if (!blocks) {
+		gz->status = -1;
+		close(gz->in);
+		return NULL;
+	}
+	for (i = 0; i < gz->threads; i++) {
+		blocks[i].in = malloc(GZIP_BLOCK_SIZE);
+		if (!blocks[i].in)
+			goto fail;
+	}
+
+	if (write_in_full(gz->out, header, sizeof(header)) < 0)
+		goto fail;
+	while (!eof) {
+		for (nr = 0; nr < gz->threads && !eof; nr++) {
+			struct gzip_block *block = &blocks[nr];
+
+			len = read_in_full(gz->in, block->in, GZIP_BLOCK_SIZE);
+			if (len < 0) {
+				gz->status = -1;
+				break;
+			}
+			if (len < GZIP_BLOCK_SIZE)
+				eof = 1;
+			block->in_len = len;
+			block->failed = 0;
+			if (nr) {
+				block->dict = blocks[nr - 1].in +
+					GZIP_BLOCK_SIZE - GZIP_WINDOW_SIZE;
+				block->dict_len = GZIP_WINDOW_SIZE;
+			} else {
+				block->dict = window;
+				block->dict_len = window_len;
+			}
+			block->threaded = !pthread_create(&block->thread, NULL,
+							  deflate_block, block);
+			if (!block->threaded)
+				deflate_block(block);
+		}
+		for (i = 0; i < nr; i++) {
+			if (blocks[i].threaded)
+				pthread_join(blocks[i].thread, NULL);
+			if (blocks[i].failed)
+				gz->status = -1;
+		}
+		if (gz->status)
+			goto out;
+		for (i = 0; i < nr; i++) {
+			if (write_in_full(gz->out, blocks[i].out,
+					  blocks[i].out_len) < 0)
+				goto fail;
+			crc = crc32_combine(crc, blocks[i].crc,
+					    blocks[i].in_len);
+			total += blocks[i].in_len;
+			FREE_AND_NULL(blocks[i].out);
+		}
+		if (!eof) {
+			memcpy(window, blocks[nr - 1].in + GZIP_BLOCK_SIZE -
+			       GZIP_WINDOW_SIZE, GZIP_WINDOW_SIZE);
+			window_len = GZIP_WINDOW_SIZE;
+		}
+	}
+
+	for (i = 0; i < 4; i++) {
+		trailer[i] = (crc >> (8 * i)) & 0xff;
+		trailer[i + 4] = (total >> (8 * i)) & 0xff;
+	}
+	if (write_in_full(gz->out, last_block, sizeof(last_block)) < 0 ||
+	    write_in_full(gz->out, trailer, sizeof(trailer)) < 0)
+		goto fail;
+	goto out;
+
+fail:
+	gz->status = -1;
+out:
+	/* Let the archive writer fail instead of blocking on the pipe. */
+	close(gz->in);
+	for (i = 0; i < gz->threads; i++) {
+		free(blocks[i].in);
+		free(blocks[i].out);
+	}
+	free(blocks);
+	return NULL;
+}
+
+static int write_tar_parallel_gzip_archive(const char *hex,
+					   const char *prefix)
+{
+	struct parallel_gzip gz = { 0 };
+	int pipe_fh[2], rv, staged;
+
+	staged = open_staged_tar(hex, prefix);
+	if (pipe(pipe_fh))
+		die_errno("Unable to create pipe to compressor");
+	gz.in = pipe_fh[0];
+	gz.out = dup(STDOUT_FILENO);
+	gz.threads = ctx.cfg.snapshot_threads;
+	if (gz.out < 0 || pthread_create(&gz.thread, NULL, run_parallel_gzip,
+					 &gz))
+		die("Unable to start compressor");
+
+	if (dup2(pipe_fh[1], STDOUT_FILENO) < 0)
+		die_errno("Unable to use pipe to compressor");
+	close(pipe_fh[1]);
+	rv = write_staged_tar_archive(staged, hex, prefix);
+
+	/* Closes the pipe, so that the compressor sees its end. */
+	dup2(gz.out, STDOUT_FILENO);
+	pthread_join(gz.thread, NULL);
+	close(gz.out);
+	if (gz.status)
+		error("Unable to compress snapshot");
+	return rv || gz.status;
+}
+
 static int write_tar_gzip_archive(const char *hex, const char *prefix)
 {
 	char *argv[] = { "gzip", "-n", NULL };
+
+	if (ctx.cfg.snapshot_threads > 1)
+		return write_tar_parallel_gzip_archive(hex, prefix);
 	return write_compressed_tar_archive(hex, prefix, argv);
 }
 
@@ -89,14 +381,26 @@ static int write_tar_lzip_archive(const char *hex, const char *prefix)
 
 static int write_tar_xz_archive(const char *hex, const char *prefix)
 {
-	char *argv[] = { "xz", NULL };
-	return write_compressed_tar_archive(hex, prefix, argv);
+	char *threads = xstrfmt("-T%d", ctx.cfg.snapshot_threads);
+	char *argv[] = { "xz", threads, NULL };
+	int rv;
+
+	if (!ctx.cfg.snapshot_threads)
+		argv[1] = NULL;
+	rv = write_compressed_tar_archive(hex, prefix, argv);
+	free(threads);
+	return rv;
 }
 
 static int write_tar_zstd_archive(const char *hex, const char *prefix)
 {
-	char *argv[] = { "zstd", "-T0", NULL };
-	return write_compressed_tar_archive(hex, prefix, argv);
+	char *threads = xstrfmt("-T%d", ctx.cfg.snapshot_threads);
+	char *argv[] = { "zstd", threads, NULL };
+	int rv;
+
+	rv = write_compressed_tar_archive(hex, prefix, argv);
+	free(threads);
+	return rv;
 }
 
 const struct cgit_snapshot_format cgit_snapshot_formats[] = {
@@ -152,6 +456,39 @@ const unsigned cgit_snapshot_format_bit(const struct cgit_snapshot_format *f)
 	return BIT(f - &cgit_snapshot_formats[0]);
 }
 
+struct snapshot_data {
+	const struct cgit_snapshot_format *format;
+	const char *hex;
+	const char *prefix;
+};
+
+static int write_snapshot(void *cbdata)
+{
+	struct snapshot_data *data = cbdata;
+
+	return data->format->write_func(data->hex, data->prefix) != 0;
+}
+
+/*
+ * The archive only depends on the commit, the prefix and the format, so
+ * it is kept by those (the commit rather than its tree, as tar archives
+ * include the commit id and date).
+ */
+static void write_cached_snapshot(const struct cgit_snapshot_format *format,
+				  const char *hex, const char *prefix)
+{
+	struct snapshot_data data = { format, hex, prefix };
+	char *path = xstrdup(snapshot_cache_path());
+	char *name = snapshot_name(hex, prefix, format->suffix);
+	char *key = snapshot_key(hex, prefix, format->suffix);
+
+	cache_file(path, name, key, (off_t)ctx.cfg.snapshot_cache_size << 20,
+		   write_snapshot, &data);
+	free(key);
+	free(name);
+	free(path);
+}
+
 static int make_snapshot(const struct cgit_snapshot_format *format,
 			 const char *hex, const char *prefix,
 			 const char *filename)
@@ -173,7 +510,13 @@ static int make_snapshot(const struct cgit_snapshot_format *format,
 	ctx.page.filename = xstrdup(filename);
 	cgit_print_http_headers();
 	init_archivers();
-	format->write_func(hex, prefix);
+	if (ctx.cfg.snapshot_cache_size > 0) {
+		char *oid_hex = xstrdup(oid_to_hex(&oid));
+
+		write_cached_snapshot(format, oid_hex, prefix);
+		free(oid_hex);
+	} else
+		format->write_func(hex, prefix);
 	return 0;
 }
 
@@ -316,3 +659,58 @@ void cgit_print_snapshot(const char *head, const char *hex,
 	free(prefix);
 	free(adj_filename);
 }
+
+/*
+ * Store the snapshots of `ref` in every format enabled for the current
+ * repository, under the names its snapshot links use. Returns non-zero
+ * if any of them could not be stored.
+ */
+int cgit_pregenerate_snapshot(const char *ref)
+{
+	const struct cgit_snapshot_format *f;
+	struct snapshot_data data;
+	struct strbuf prefix = STRBUF_INIT;
+	struct object_id oid;
+	const char *basename;
+	char *path, *name, *key, *hex;
+	int fd, err = 0;
+
+	if (repo_get_oid(the_repository, ref, &oid) ||
+	    !lookup_commit_reference(the_repository, &oid))
+		return 0;
+	hex = xstrdup(oid_to_hex(&oid));
+
+	basename = cgit_snapshot_prefix(ctx.repo);
+	if (starts_with(ref, basename))
+		strbuf_addstr(&prefix, ref);
+	else
+		cgit_compose_snapshot_prefix(&prefix, basename, ref);
+
+	init_archivers();
+	path = xstrdup(snapshot_cache_path());
+	for (f = cgit_snapshot_formats; f->suffix; f++) {
+		if (!(ctx.repo->snapshots & cgit_snapshot_format_bit(f)))
+			continue;
+		data.format = f;
+		data.hex = hex;
+		data.prefix = prefix.buf;
+		name = snapshot_name(hex, prefix.buf, f->suffix);
+		key = snapshot_key(hex, prefix.buf, f->suffix);
+		fd = cache_file_open(path, name, key,
+				     (off_t)ctx.cfg.snapshot_cache_size << 20,
+				     write_snapshot, &data);
+		if (fd < 0) {
+			fprintf(stderr, "Failed to store %s%s of %s\n",
+				prefix.buf, f->suffix, ctx.repo->name);
+			err = 1;
+		} else {
+			close(fd);
+		}
+		free(key);
+		free(name);
+	}
+	free(path);
+	free(hex);
+	strbuf_release(&prefix);
+	return err;
+}
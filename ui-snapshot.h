@@ -3,5 +3,6 @@
 
 extern void cgit_print_snapshot(const char *head, const char *hex,
 				const char *filename, int dwim);
+extern int cgit_pregenerate_snapshot(const char *ref);
 
 #endif /* UI_SNAPSHOT_H */
@@ -12,10 +12,41 @@
 #include "ui-stats.h"
 #include "html.h"
 #include "ui-shared.h"
+#include "cache.h"
+#include "commit-reach.h"
+#include "strmap.h"
+
+/* Commit counts are kept in two tables of (author, bucket, count) columns,
+ * one with weekly and one with monthly buckets; quarters and years are
+ * summed up from the months. Authors are interned to small integers, and
+ * the cells are indexed by a hashmap while counting.
+ */
+struct stats_column {
+	uint32_t *author;
+	uint32_t *bucket;
+	uint32_t *count;
+	size_t nr, alloc;
+};
+
+struct stats_cell {
+	struct hashmap_entry ent;
+	uint64_t key;
+	size_t row;
+};
+
+struct stats_aggregate {
+	struct object_id tip;
+	struct strintmap ids;
+	char **authors;
+	size_t authors_nr, authors_alloc;
+	struct stats_column columns[STATS_BUCKETS];
+	struct hashmap cells;
+};
 
 struct authorstat {
+	const char *name;
 	long total;
-	struct string_list list;
+	long *counts;
 };
 
 #define DAY_SECS (60 * 60 * 24)
@@ -130,10 +161,10 @@ static char *pretty_year(struct tm *tm)
 }
 
 static const struct cgit_period periods[] = {
-	{'w', "week", 12, 4, trunc_week, dec_week, inc_week, pretty_week},
-	{'m', "month", 12, 4, trunc_month, dec_month, inc_month, pretty_month},
-	{'q', "quarter", 12, 4, trunc_quarter, dec_quarter, inc_quarter, pretty_quarter},
-	{'y', "year", 12, 4, trunc_year, dec_year, inc_year, pretty_year},
+	{'w', "week", 12, 4, trunc_week, dec_week, inc_week, pretty_week, STATS_WEEKS, 1},
+	{'m', "month", 12, 4, trunc_month, dec_month, inc_month, pretty_month, STATS_MONTHS, 1},
+	{'q', "quarter", 12, 4, trunc_quarter, dec_quarter, inc_quarter, pretty_quarter, STATS_MONTHS, 3},
+	{'y', "year", 12, 4, trunc_year, dec_year, inc_year, pretty_year, STATS_MONTHS, 12},
 };
 
 /* Given a period code or name, return a period index (1, 2, 3 or 4)
@@ -168,77 +199,155 @@ const char *cgit_find_stats_periodname(int idx)
 		return "";
 }
 
-static void add_commit(struct string_list *authors, struct commit *commit,
-	const struct cgit_period *period)
+/* Weeks are counted from the monday before the epoch, months from year 0 */
+static uint32_t week_bucket(time_t t)
 {
-	struct commitinfo *info;
-	struct string_list_item *author, *item;
-	struct authorstat *authorstat;
-	struct string_list *items;
-	char *tmp;
-	struct tm date;
-	time_t t;
-	uintptr_t *counter;
-
-	info = cgit_parse_commit(commit);
-	tmp = xstrdup(info->author);
-	author = string_list_insert(authors, tmp);
-	if (!author->util)
-		author->util = xcalloc(1, sizeof(struct authorstat));
-	else
-		free(tmp);
-	authorstat = author->util;
-	items = &authorstat->list;
-	t = info->committer_date;
-	gmtime_r(&t, &date);
-	period->trunc(&date);
-	tmp = xstrdup(period->pretty(&date));
-	item = string_list_insert(items, tmp);
-	counter = (uintptr_t *)&item->util;
-	if (*counter)
-		free(tmp);
-	(*counter)++;
+	return (t / DAY_SECS + 3) / 7;
+}
 
-	authorstat->total++;
-	cgit_free_commitinfo(info);
+static uint32_t month_bucket(const struct tm *tm)
+{
+	return (tm->tm_year + 1900) * 12 + tm->tm_mon;
 }
 
-static int cmp_total_commits(const void *a1, const void *a2)
+static int stats_cell_cmp(const void *cmp_data,
+			  const struct hashmap_entry *e1,
+			  const struct hashmap_entry *e2,
+			  const void *keydata)
+{
+	const struct stats_cell *c1 = container_of(e1, const struct stats_cell, ent);
+	const struct stats_cell *c2 = container_of(e2, const struct stats_cell, ent);
+
+	return c1->key != c2->key;
+}
+
+static void stats_init(struct stats_aggregate *agg)
+{
+	memset(agg, 0, sizeof(*agg));
+	strintmap_init_with_options(&agg->ids, -1, NULL, 1);
+	hashmap_init(&agg->cells, stats_cell_cmp, NULL, 0);
+}
+
+static void stats_clear(struct stats_aggregate *agg)
+{
+	size_t i;
+
+	strintmap_clear(&agg->ids);
+	for (i = 0; i < agg->authors_nr; i++)
+		free(agg->authors[i]);
+	free(agg->authors);
+	for (i = 0; i < STATS_BUCKETS; i++) {
+		free(agg->columns[i].author);
+		free(agg->columns[i].bucket);
+		free(agg->columns[i].count);
+	}
+	hashmap_clear_and_free(&agg->cells, struct stats_cell, ent);
+}
+
+static uint32_t intern_author(struct stats_aggregate *agg, const char *name)
+{
+	int id = strintmap_get(&agg->ids, name);
+
+	if (id >= 0)
+		return id;
+	ALLOC_GROW(agg->authors, agg->authors_nr + 1, agg->authors_alloc);
+	agg->authors[agg->authors_nr] = xstrdup(name);
+	strintmap_set(&agg->ids, name, agg->authors_nr);
+	return agg->authors_nr++;
+}
+
+static void add_count(struct stats_aggregate *agg, int kind, uint32_t author,
+		      uint32_t bucket, uint32_t count)
+{
+	struct stats_column *col = &agg->columns[kind];
+	struct stats_cell key, *cell;
+
+	key.key = ((uint64_t)kind << 63) | ((uint64_t)author << 32) | bucket;
+	hashmap_entry_init(&key.ent, memhash(&key.key, sizeof(key.key)));
+	cell = hashmap_get_entry(&agg->cells, &key, ent, NULL);
+	if (cell) {
+		col->count[cell->row] += count;
+		return;
+	}
+
+	if (col->nr >= col->alloc) {
+		col->alloc = alloc_nr(col->alloc);
+		REALLOC_ARRAY(col->author, col->alloc);
+		REALLOC_ARRAY(col->bucket, col->alloc);
+		REALLOC_ARRAY(col->count, col->alloc);
+	}
+	col->author[col->nr] = author;
+	col->bucket[col->nr] = bucket;
+	col->count[col->nr] = count;
+
+	cell = xmalloc(sizeof(*cell));
+	*cell = key;
+	cell->row = col->nr++;
+	hashmap_add(&agg->cells, &cell->ent);
+}
+
+/* Get the author name of a commit without parsing the whole commit,
+ * unless the name may need to be reencoded.
+ */
+static void get_author(struct commit *commit, struct strbuf *name)
 {
-	const struct string_list_item *i1 = a1;
-	const struct string_list_item *i2 = a2;
-	const struct authorstat *auth1 = i1->util;
-	const struct authorstat *auth2 = i2->util;
+	const char *buf = repo_get_commit_buffer(the_repository, commit, NULL);
+	struct commitinfo *info;
+	struct ident_split ident;
+	const char *p;
+	size_t len;
+
+	strbuf_reset(name);
+	if (find_commit_header(buf, "encoding", &len)) {
+		repo_unuse_commit_buffer(the_repository, commit, buf);
+		info = cgit_parse_commit(commit);
+		if (info->author)
+			strbuf_addstr(name, info->author);
+		cgit_free_commitinfo(info);
+		return;
+	}
+	p = find_commit_header(buf, "author", &len);
+	if (p && !split_ident_line(&ident, p, len))
+		strbuf_add(name, ident.name_begin,
+			   ident.name_end - ident.name_begin);
+	repo_unuse_commit_buffer(the_repository, commit, buf);
+}
 
-	return auth2->total - auth1->total;
+static void add_commit(struct stats_aggregate *agg, struct commit *commit,
+		       struct strbuf *name)
+{
+	time_t t = commit->date;
+	struct tm date;
+	uint32_t author;
+
+	get_author(commit, name);
+	author = intern_author(agg, name->buf);
+	gmtime_r(&t, &date);
+	add_count(agg, STATS_WEEKS, author, week_bucket(t), 1);
+	add_count(agg, STATS_MONTHS, author, month_bucket(&date), 1);
 }
 
-/* Walk the commit DAG and collect number of commits per author per
- * timeperiod into a nested string_list collection.
+/* Walk the commits reachable from `tip` but not from the tip the aggregate
+ * was last updated from, optionally limited to those after `since`.
  */
-static struct string_list collect_stats(const struct cgit_period *period)
+static void walk_stats(struct stats_aggregate *agg, const char *tip,
+		       const char *since)
 {
-	struct string_list authors;
+	struct strvec argv = STRVEC_INIT;
+	struct strbuf name = STRBUF_INIT;
 	struct rev_info rev;
 	struct commit *commit;
-	const char *argv[] = {NULL, ctx.qry.head, NULL, NULL, NULL, NULL};
-	int argc = 3;
-	time_t now;
-	long i;
-	struct tm tm;
-	char tmp[11];
 
-	time(&now);
-	gmtime_r(&now, &tm);
-	period->trunc(&tm);
-	for (i = 1; i < period->count; i++)
-		period->dec(&tm);
-	strftime(tmp, sizeof(tmp), "%Y-%m-%d", &tm);
-	argv[2] = xstrdup(fmt("--since=%s", tmp));
+	strvec_push(&argv, "stats");
+	strvec_push(&argv, tip);
+	if (!is_null_oid(&agg->tip))
+		strvec_pushf(&argv, "^%s", oid_to_hex(&agg->tip));
+	if (since)
+		strvec_pushf(&argv, "--since=%s", since);
 	if (ctx.qry.path) {
-		argv[3] = "--";
-		argv[4] = ctx.qry.path;
-		argc += 2;
+		strvec_push(&argv, "--");
+		strvec_push(&argv, ctx.qry.path);
+		cgit_update_bloom_filters(tip);
 	}
 	repo_init_revisions(the_repository, &rev, NULL);
 	rev.abbrev = DEFAULT_ABBREV;
@@ -246,69 +355,220 @@ static struct string_list collect_stats(const struct cgit_period *period)
 	rev.max_parents = 1;
 	rev.verbose_header = 1;
 	rev.show_root_diff = 0;
-	setup_revisions(argc, argv, &rev, NULL);
+	setup_revisions(argv.nr, argv.v, &rev, NULL);
 	prepare_revision_walk(&rev);
-	memset(&authors, 0, sizeof(authors));
 	while ((commit = get_revision(&rev)) != NULL) {
-		add_commit(&authors, commit, period);
+		add_commit(agg, commit, &name);
 		release_commit_memory(the_repository->parsed_objects, commit);
 		commit->parents = NULL;
 	}
-	return authors;
+	strbuf_release(&name);
+	strvec_clear(&argv);
 }
 
-static void print_combined_authorrow(struct string_list *authors, int from,
-				     int to, const char *name,
-				     const char *leftclass,
-				     const char *centerclass,
-				     const char *rightclass,
-				     const struct cgit_period *period)
+/* The stored aggregate is the tip it was computed from, followed by one
+ * "a <name>" line per author (in id order) and one "<w|m> <author>
+ * <bucket> <count>" line per cell.
+ */
+static void write_stats(struct stats_aggregate *agg, struct strbuf *buf)
 {
-	struct string_list_item *author;
-	struct authorstat *authorstat;
-	struct string_list *items;
-	struct string_list_item *date;
+	struct stats_column *col;
+	size_t i;
+	int kind;
+
+	strbuf_reset(buf);
+	strbuf_addf(buf, "%s\n", oid_to_hex(&agg->tip));
+	for (i = 0; i < agg->authors_nr; i++)
+		strbuf_addf(buf, "a %s\n", agg->authors[i]);
+	for (kind = 0; kind < STATS_BUCKETS; kind++) {
+		col = &agg->columns[kind];
+		for (i = 0; i < col->nr; i++)
+			strbuf_addf(buf, "%c %u %u %u\n", "wm"[kind],
+				    col->author[i], col->bucket[i],
+				    col->count[i]);
+	}
+}
+
+static int read_stats(struct stats_aggregate *agg, const char *p)
+{
+	const char *end;
+	unsigned author, bucket, count;
+	char *name;
+
+	if (parse_oid_hex(p, &agg->tip, &p) || *p++ != '\n')
+		return -1;
+	while (*p) {
+		end = strchrnul(p, '\n');
+		if (p[0] == 'a' && p[1] == ' ') {
+			name = xmemdupz(p + 2, end - p - 2);
+			intern_author(agg, name);
+			free(name);
+		} else if ((p[0] == 'w' || p[0] == 'm') &&
+			   sscanf(p + 1, "%u %u %u", &author, &bucket, &count) == 3 &&
+			   author < agg->authors_nr) {
+			add_count(agg, p[0] == 'w' ? STATS_WEEKS : STATS_MONTHS,
+				  author, bucket, count);
+		} else {
+			return -1;
+		}
+		p = *end ? end + 1 : end;
+	}
+	return 0;
+}
+
+static char *stats_cache_path(void)
+{
+	return fmt("%s/stats", ctx.cfg.cache_root);
+}
+
+/* Count the commits per author per bucket. When enable-stats-cache is set
+ * the counts for the whole history are kept below cache-root and updated
+ * from the tip they were last computed for; otherwise only the commits
+ * in the displayed periods are walked.
+ */
+static void collect_stats(struct stats_aggregate *agg,
+			  const struct cgit_period *period)
+{
+	struct strbuf buf = STRBUF_INIT;
+	struct object_id tip;
+	struct commit *old, *new;
 	time_t now;
-	long i, j, total, subtotal;
+	long i;
 	struct tm tm;
-	char *tmp;
+	char tmp[11];
+	char *key;
+
+	stats_init(agg);
+	if (!ctx.cfg.enable_stats_cache || ctx.cfg.cache_size <= 0 ||
+	    repo_get_oid(the_repository, ctx.qry.head, &tip)) {
+		time(&now);
+		gmtime_r(&now, &tm);
+		period->trunc(&tm);
+		for (i = 1; i < period->count; i++)
+			period->dec(&tm);
+		strftime(tmp, sizeof(tmp), "%Y-%m-%d", &tm);
+		walk_stats(agg, ctx.qry.head, tmp);
+		return;
+	}
+
+	key = xstrfmt("%s %s %s", ctx.repo->url, ctx.qry.head,
+		      ctx.qry.path ? ctx.qry.path : "");
+	if (!cache_get(ctx.cfg.cache_size, stats_cache_path(), key, -1, &buf) &&
+	    read_stats(agg, buf.buf)) {
+		stats_clear(agg);
+		stats_init(agg);
+	}
+	if (oideq(&agg->tip, &tip))
+		goto out;
+
+	/* Start over if the branch was rewound */
+	if (!is_null_oid(&agg->tip)) {
+		old = lookup_commit_reference_gently(the_repository, &agg->tip, 1);
+		new = lookup_commit_reference_gently(the_repository, &tip, 1);
+		if (!old || !new ||
+		    repo_in_merge_bases(the_repository, old, new) <= 0) {
+			stats_clear(agg);
+			stats_init(agg);
+		}
+	}
+
+	walk_stats(agg, oid_to_hex(&tip), NULL);
+	oidcpy(&agg->tip, &tip);
+	write_stats(agg, &buf);
+	cache_put(ctx.cfg.cache_size, stats_cache_path(), key, buf.buf, buf.len);
+out:
+	strbuf_release(&buf);
+	free(key);
+}
+
+static int cmp_total_commits(const void *a1, const void *a2)
+{
+	const struct authorstat *auth1 = a1;
+	const struct authorstat *auth2 = a2;
+
+	if (auth1->total != auth2->total)
+		return auth1->total < auth2->total ? 1 : -1;
+	return strcmp(auth1->name, auth2->name);
+}
+
+/* Sum up the aggregate for the displayed periods, and return the authors
+ * with commits in them sorted by their number of commits.
+ */
+static struct authorstat *count_periods(struct stats_aggregate *agg,
+					const struct cgit_period *period,
+					long **counts_p, size_t *nr)
+{
+	struct stats_column *col = &agg->columns[period->bucket];
+	struct authorstat *authors;
+	long *counts;
+	time_t now;
+	struct tm tm;
+	uint32_t first;
+	size_t i, j;
+	long idx;
 
 	time(&now);
 	gmtime_r(&now, &tm);
 	period->trunc(&tm);
 	for (i = 1; i < period->count; i++)
 		period->dec(&tm);
+	if (period->bucket == STATS_WEEKS)
+		first = week_bucket(timegm(&tm));
+	else
+		first = month_bucket(&tm) / period->span;
+
+	counts = *counts_p = xcalloc(st_mult(agg->authors_nr, period->count),
+				     sizeof(long));
+	for (i = 0; i < col->nr; i++) {
+		idx = (long)(col->bucket[i] / period->span) - (long)first;
+		if (idx >= 0 && idx < period->count)
+			counts[col->author[i] * period->count + idx] += col->count[i];
+	}
+
+	ALLOC_ARRAY(authors, agg->authors_nr);
+	*nr = 0;
+	for (i = 0; i < agg->authors_nr; i++) {
+		struct authorstat *author = &authors[*nr];
+
+		author->name = agg->authors[i];
+		author->counts = counts + i * period->count;
+		author->total = 0;
+		for (j = 0; j < period->count; j++)
+			author->total += author->counts[j];
+		if (author->total)
+			(*nr)++;
+	}
+	QSORT(authors, *nr, cmp_total_commits);
+	return authors;
+}
+
+static void print_combined_authorrow(struct authorstat *authors, int from,
+				     int to, const char *name,
+				     const char *leftclass,
+				     const char *centerclass,
+				     const char *rightclass,
+				     const struct cgit_period *period)
+{
+	long i, j, total, subtotal;
 
 	total = 0;
 	htmlf("<tr><td class='%s'>%s</td>", leftclass,
 		fmt(name, to - from + 1));
 	for (j = 0; j < period->count; j++) {
-		tmp = period->pretty(&tm);
-		period->inc(&tm);
 		subtotal = 0;
-		for (i = from; i <= to; i++) {
-			author = &authors->items[i];
-			authorstat = author->util;
-			items = &authorstat->list;
-			date = string_list_lookup(items, tmp);
-			if (date)
-				subtotal += (uintptr_t)date->util;
-		}
+		for (i = from; i <= to; i++)
+			subtotal += authors[i].counts[j];
 		htmlf("<td class='%s'>%ld</td>", centerclass, subtotal);
 		total += subtotal;
 	}
 	htmlf("<td class='%s'>%ld</td></tr>", rightclass, total);
 }
 
-static void print_authors(struct string_list *authors, int top,
+static void print_authors(struct authorstat *authors, int nr, int top,
 			  const struct cgit_period *period)
 {
-	struct string_list_item *author;
-	struct authorstat *authorstat;
-	struct string_list *items;
-	struct string_list_item *date;
 	time_t now;
-	long i, j, total;
+	long i, j;
 	struct tm tm;
 	char *tmp;
 
@@ -326,50 +586,37 @@ static void print_authors(struct string_list *authors, int top,
 	}
 	html("<th>Total</th></tr>\n");
 
-	if (top <= 0 || top > authors->nr)
-		top = authors->nr;
+	if (top <= 0 || top > nr)
+		top = nr;
 
 	for (i = 0; i < top; i++) {
-		author = &authors->items[i];
 		html("<tr><td class='left'>");
-		html_txt(author->string);
+		html_txt(authors[i].name);
 		html("</td>");
-		authorstat = author->util;
-		items = &authorstat->list;
-		total = 0;
 		for (j = 0; j < period->count; j++)
-			period->dec(&tm);
-		for (j = 0; j < period->count; j++) {
-			tmp = period->pretty(&tm);
-			period->inc(&tm);
-			date = string_list_lookup(items, tmp);
-			if (!date)
-				html("<td>0</td>");
-			else {
-				htmlf("<td>%lu</td>", (uintptr_t)date->util);
-				total += (uintptr_t)date->util;
-			}
-		}
-		htmlf("<td class='sum'>%ld</td></tr>", total);
+			htmlf("<td>%ld</td>", authors[i].counts[j]);
+		htmlf("<td class='sum'>%ld</td></tr>", authors[i].total);
 	}
 
-	if (top < authors->nr)
-		print_combined_authorrow(authors, top, authors->nr - 1,
+	if (top < nr)
+		print_combined_authorrow(authors, top, nr - 1,
 			"Others (%ld)", "left", "", "sum", period);
 
-	print_combined_authorrow(authors, 0, authors->nr - 1, "Total",
+	print_combined_authorrow(authors, 0, nr - 1, "Total",
 		"total", "sum", "sum", period);
 	html("</table>");
 }
 
-/* Create a sorted string_list with one entry per author. The util-field
- * for each author is another string_list which is used to calculate the
- * number of commits per time-interval.
+/* Collect the number of commits per author and time-interval, and print
+ * them as a table sorted by the number of commits per author.
  */
 void cgit_show_stats(void)
 {
-	struct string_list authors;
+	struct stats_aggregate agg;
+	struct authorstat *authors;
 	const struct cgit_period *period;
+	long *counts;
+	size_t nr;
 	int top, i;
 	const char *code = "w";
 
@@ -387,9 +634,8 @@ void cgit_show_stats(void)
 			"Statistics type disabled: %s", period->name);
 		return;
 	}
-	authors = collect_stats(period);
-	qsort(authors.items, authors.nr, sizeof(struct string_list_item),
-		cmp_total_commits);
+	collect_stats(&agg, period);
+	authors = count_periods(&agg, period, &counts, &nr);
 
 	top = ctx.qry.ofs;
 	if (!top)
@@ -429,7 +675,11 @@ void cgit_show_stats(void)
 		html("')");
 	}
 	html("</h2>");
-	print_authors(&authors, top, period);
+	print_authors(authors, nr, top, period);
 	cgit_print_layout_end();
+
+	free(counts);
+	free(authors);
+	stats_clear(&agg);
 }
 
@@ -3,6 +3,12 @@
 
 #include "cgit.h"
 
+enum stats_bucket {
+	STATS_WEEKS,
+	STATS_MONTHS,
+	STATS_BUCKETS
+};
+
 struct cgit_period {
 	const char code;
 	const char *name;
@@ -18,6 +24,10 @@ struct cgit_period {
 
 	/* Pretty-print a tm value */
 	char *(*pretty)(struct tm *tm);
+
+	/* Buckets of the commit count aggregate covered by one period */
+	enum stats_bucket bucket;
+	int span;
 };
 
 extern int cgit_find_stats_period(const char *expr, const struct cgit_period **period);
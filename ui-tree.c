@@ -12,13 +12,41 @@
 #include "ui-tree.h"
 #include "html.h"
 #include "ui-shared.h"
+#include "cache.h"
+#include "commit-slab.h"
+#include "oidset.h"
+#include "packfile.h"
+#include "prio-queue.h"
+#include "strmap.h"
+#include "tree-walk.h"
 
 struct walk_tree_context {
 	char *curr_rev;
 	char *match_path;
+	struct commit *commit;
+	struct object_id tree_oid;
 	int state;
 };
 
+/* An entry of the listed tree, with the position of its object in the
+ * pack it is stored in (if any), see read_entry_sizes().
+ */
+struct ls_entry {
+	struct object_id oid;
+	char *name;
+	unsigned mode;
+	enum object_type type;
+	unsigned long size;
+	struct packed_git *pack;
+	off_t offset;
+	struct commit *last_commit;
+};
+
+struct ls_entries {
+	struct ls_entry *items;
+	size_t nr, alloc;
+};
+
 static void print_text_buffer(const char *name, char *buf, unsigned long size)
 {
 	unsigned long lineno, idx;
@@ -86,12 +114,31 @@ static void print_binary_buffer(char *buf, unsigned long size)
 	html("</table>\n");
 }
 
+struct blob_content {
+	char *buf;
+	unsigned long size;
+	const char *basename;
+	bool is_binary;
+};
+
+static int print_blob_content(void *cbdata)
+{
+	struct blob_content *blob = cbdata;
+
+	if (blob->is_binary)
+		print_binary_buffer(blob->buf, blob->size);
+	else
+		print_text_buffer(blob->basename, blob->buf, blob->size);
+	return 0;
+}
+
 static void print_object(const struct object_id *oid, const char *path, const char *basename, const char *rev)
 {
 	enum object_type type;
-	char *buf;
+	char *buf, *key;
 	unsigned long size;
 	bool is_binary;
+	struct blob_content blob;
 
 	type = odb_read_object_info(the_repository->objects, oid, &size);
 	if (type == OBJ_BAD) {
@@ -127,11 +174,16 @@ static void print_object(const struct object_id *oid, const char *path, const ch
 		return;
 	}
 
-	if (is_binary)
-		print_binary_buffer(buf, size);
-	else
-		print_text_buffer(basename, buf, size);
-
+	/* The source filter may pick a syntax by the file name. */
+	blob.buf = buf;
+	blob.size = size;
+	blob.basename = basename;
+	blob.is_binary = is_binary;
+	key = xstrfmt("blob %s %d %d %s", oid_to_hex(oid),
+		      ctx.cfg.enable_tree_linenumbers,
+		      ctx.repo->source_filter != NULL, basename);
+	cgit_print_fragment(key, print_blob_content, &blob);
+	free(key);
 	free(buf);
 }
 
@@ -177,8 +229,7 @@ static void write_tree_link(const struct object_id *oid, char *name,
 	oidcpy(&tree_ctx.oid, oid);
 
 	while (tree_ctx.count == 1) {
-		cgit_tree_link(name, NULL, "ls-dir", ctx.qry.head, rev,
-			       fullpath->buf);
+		cgit_tree_link(name, NULL, "ls-dir", NULL, rev, fullpath->buf);
 
 		tree = lookup_tree(the_repository, &tree_ctx.oid);
 		if (!tree)
@@ -200,30 +251,55 @@ static void write_tree_link(const struct object_id *oid, char *name,
 	strbuf_setlen(fullpath, initial_length);
 }
 
-static int ls_item(const struct object_id *oid, struct strbuf *base,
-		const char *pathname, unsigned mode, void *cbdata)
+define_commit_slab(commitinfo_slab, struct commitinfo *);
+
+static void print_last_commit(struct ls_entry *entry,
+			      struct commitinfo_slab *infos)
 {
-	struct walk_tree_context *walk_tree_ctx = cbdata;
-	char *name;
+	struct commitinfo **info;
+
+	if (!entry->last_commit) {
+		html("<td/><td/>");
+		return;
+	}
+	info = commitinfo_slab_at(infos, entry->last_commit);
+	if (!*info)
+		*info = cgit_parse_commit(entry->last_commit);
+	html("<td>");
+	cgit_commit_link((*info)->subject, NULL, NULL, NULL,
+			 oid_to_hex(&entry->last_commit->object.oid), NULL);
+	html("</td><td class='ls-date'>");
+	html_txt(show_date((*info)->committer_date, (*info)->committer_tz,
+			   cgit_date_mode(DATE_SHORT)));
+	html("</td>");
+}
+
+static void ls_item(struct ls_entry *entry,
+		    struct walk_tree_context *walk_tree_ctx,
+		    struct commitinfo_slab *infos)
+{
+	const struct object_id *oid = &entry->oid;
+	unsigned mode = entry->mode;
+	char *name = entry->name;
 	struct strbuf fullpath = STRBUF_INIT;
 	struct strbuf linkpath = STRBUF_INIT;
 	struct strbuf class = STRBUF_INIT;
 	enum object_type type;
-	unsigned long size = 0;
+	unsigned long size = entry->size;
+	char rev[GIT_MAX_HEXSZ + 1];
 	char *buf;
 
-	name = xstrdup(pathname);
+	oid_to_hex_r(rev, &walk_tree_ctx->commit->object.oid);
 	strbuf_addf(&fullpath, "%s%s%s", ctx.qry.path ? ctx.qry.path : "",
 		    ctx.qry.path ? "/" : "", name);
 
-	if (!S_ISGITLINK(mode)) {
-		type = odb_read_object_info(the_repository->objects, oid, &size);
-		if (type == OBJ_BAD) {
-			htmlf("<tr><td colspan='3'>Bad object: %s %s</td></tr>",
-			      name,
-			      oid_to_hex(oid));
-			goto cleanup;
-		}
+	if (entry->type == OBJ_BAD) {
+		htmlf("<tr><td colspan='%d'>Bad object: %s %s</td></tr>",
+		      3 + !!ctx.repo->enable_tree_sizes +
+		      2 * !!ctx.repo->enable_tree_last_commit,
+		      name,
+		      oid_to_hex(oid));
+		goto cleanup;
 	}
 
 	html("<tr><td class='ls-mode'>");
@@ -232,15 +308,14 @@ static int ls_item(const struct object_id *oid, struct strbuf *base,
 	if (S_ISGITLINK(mode)) {
 		cgit_submodule_link("ls-mod", fullpath.buf, oid_to_hex(oid));
 	} else if (S_ISDIR(mode)) {
-		write_tree_link(oid, name, walk_tree_ctx->curr_rev,
-				&fullpath);
+		write_tree_link(oid, name, rev, &fullpath);
 	} else {
 		char *ext = strrchr(name, '.');
 		strbuf_addstr(&class, "ls-blob");
 		if (ext)
 			strbuf_addf(&class, " %s", ext + 1);
-		cgit_tree_link(name, NULL, class.buf, ctx.qry.head,
-			       walk_tree_ctx->curr_rev, fullpath.buf);
+		cgit_tree_link(name, NULL, class.buf, NULL, rev,
+			       fullpath.buf);
 	}
 	if (S_ISLNK(mode)) {
 		html(" -> ");
@@ -252,35 +327,387 @@ static int ls_item(const struct object_id *oid, struct strbuf *base,
 		strbuf_addbuf(&linkpath, &fullpath);
 		strbuf_addf(&linkpath, "/../%s", buf);
 		strbuf_normalize_path(&linkpath);
-		cgit_tree_link(buf, NULL, class.buf, ctx.qry.head,
-			walk_tree_ctx->curr_rev, linkpath.buf);
+		cgit_tree_link(buf, NULL, class.buf, NULL, rev,
+			       linkpath.buf);
 		free(buf);
 		strbuf_release(&linkpath);
 	}
-	htmlf("</td><td class='ls-size'>%li</td>", size);
+	if (ctx.repo->enable_tree_sizes)
+		htmlf("</td><td class='ls-size'>%li</td>", size);
+	else
+		html("</td>");
+	if (ctx.repo->enable_tree_last_commit)
+		print_last_commit(entry, infos);
 
 	html("<td>");
-	cgit_log_link("log", NULL, "button", ctx.qry.head,
-		      walk_tree_ctx->curr_rev, fullpath.buf, 0, NULL, NULL,
-		      ctx.qry.showmsg, 0);
+	cgit_log_link("log", NULL, "button", NULL, rev, fullpath.buf, 0, NULL,
+		      NULL, ctx.qry.showmsg, 0);
 	if (ctx.repo->max_stats)
 		cgit_stats_link("stats", NULL, "button", ctx.qry.head,
 				fullpath.buf);
 	if (!S_ISGITLINK(mode))
-		cgit_plain_link("plain", NULL, "button", ctx.qry.head,
-				walk_tree_ctx->curr_rev, fullpath.buf);
+		cgit_plain_link("plain", NULL, "button", NULL, rev,
+				fullpath.buf);
 	if (!S_ISDIR(mode) && ctx.repo->enable_blame)
-		cgit_blame_link("blame", NULL, "button", ctx.qry.head,
-				walk_tree_ctx->curr_rev, fullpath.buf);
+		cgit_blame_link("blame", NULL, "button", NULL, rev,
+				fullpath.buf);
 	html("</td></tr>\n");
 
 cleanup:
-	free(name);
 	strbuf_release(&fullpath);
 	strbuf_release(&class);
+}
+
+static int collect_entry(const struct object_id *oid, struct strbuf *base,
+			 const char *pathname, unsigned mode, void *cbdata)
+{
+	struct ls_entries *entries = cbdata;
+	struct ls_entry *entry;
+
+	ALLOC_GROW(entries->items, entries->nr + 1, entries->alloc);
+	entry = &entries->items[entries->nr++];
+	memset(entry, 0, sizeof(*entry));
+	oidcpy(&entry->oid, oid);
+	entry->name = xstrdup(pathname);
+	entry->mode = mode;
+	entry->type = OBJ_NONE;
+	return 0;
+}
+
+static int cmp_pack_order(const void *a, const void *b)
+{
+	const struct ls_entry *e1 = *(const struct ls_entry **)a;
+	const struct ls_entry *e2 = *(const struct ls_entry **)b;
+
+	if (e1->pack != e2->pack)
+		return (uintptr_t)e1->pack < (uintptr_t)e2->pack ? -1 : 1;
+	if (e1->offset != e2->offset)
+		return e1->offset < e2->offset ? -1 : 1;
+	return 0;
+}
+
+/* Look up the sizes of all entries at once. Finding the objects in the
+ * pack indexes is cheap, so do that first and then read the object
+ * headers at the found offsets in the order they are stored in the
+ * packs.
+ */
+static void read_entry_sizes(struct ls_entries *entries)
+{
+	struct ls_entry **order;
+	struct ls_entry *entry;
+	size_t i, nr = 0;
+
+	ALLOC_ARRAY(order, entries->nr);
+	for (i = 0; i < entries->nr; i++) {
+		struct pack_entry e;
+
+		entry = &entries->items[i];
+		if (S_ISGITLINK(entry->mode))
+			continue;
+		/* Objects which are not found in a pack index are looked
+		 * up in full below.
+		 */
+		if (find_pack_entry(the_repository, &entry->oid, &e)) {
+			entry->pack = e.p;
+			entry->offset = e.offset;
+		}
+		order[nr++] = entry;
+	}
+	QSORT(order, nr, cmp_pack_order);
+	for (i = 0; i < nr; i++) {
+		struct object_info oi = OBJECT_INFO_INIT;
+
+		entry = order[i];
+		oi.typep = &entry->type;
+		oi.sizep = &entry->size;
+		if (!entry->pack)
+			entry->type = odb_read_object_info(the_repository->objects,
+							   &entry->oid,
+							   &entry->size);
+		else if (packed_object_info(entry->pack, entry->offset, &oi) < 0)
+			entry->type = OBJ_BAD;
+	}
+	free(order);
+}
+
+static char *last_commits_cache_path(void)
+{
+	return fmt("%s/tree-commits", ctx.cfg.cache_root);
+}
+
+/* Stored as one "<commit> <name>" record, NUL-terminated, per entry. */
+static int load_last_commits(struct commit *tip, const char *dir,
+			     struct strmap *names)
+{
+	struct strbuf buf = STRBUF_INIT;
+	char *key = xstrfmt("%s:%s", oid_to_hex(&tip->object.oid), dir);
+	struct object_id oid;
+	struct hashmap_iter iter;
+	struct strmap_entry *e;
+	struct ls_entry *entry;
+	struct commit *commit;
+	const char *p, *end;
+	int ret = -1;
+
+	if (cache_get(ctx.cfg.cache_size, last_commits_cache_path(), key, -1,
+		      &buf))
+		goto out;
+	for (p = buf.buf; p < buf.buf + buf.len; p = end + 1) {
+		end = p + strlen(p);
+		if (parse_oid_hex(p, &oid, &p) || *p++ != ' ')
+			goto out;
+		commit = lookup_commit(the_repository, &oid);
+		if (!commit || repo_parse_commit(the_repository, commit))
+			goto out;
+		entry = strmap_get(names, p);
+		if (entry)
+			entry->last_commit = commit;
+	}
+	ret = 0;
+out:
+	if (ret) {
+		strmap_for_each_entry(names, &iter, e) {
+			entry = e->value;
+			entry->last_commit = NULL;
+		}
+	}
+	strbuf_release(&buf);
+	free(key);
+	return ret;
+}
+
+static void store_last_commits(struct commit *tip, const char *dir,
+			       const struct ls_entries *entries)
+{
+	struct strbuf buf = STRBUF_INIT;
+	char *key = xstrfmt("%s:%s", oid_to_hex(&tip->object.oid), dir);
+	size_t i;
+
+	for (i = 0; i < entries->nr; i++) {
+		if (!entries->items[i].last_commit)
+			continue;
+		strbuf_addf(&buf, "%s %s",
+			    oid_to_hex(&entries->items[i].last_commit->object.oid),
+			    entries->items[i].name);
+		strbuf_addch(&buf, '\0');
+	}
+	cache_put(ctx.cfg.cache_size, last_commits_cache_path(), key,
+		  buf.buf, buf.len);
+	strbuf_release(&buf);
+	free(key);
+}
+
+/* Look up the directory `dir` (the root tree if empty) in `commit`. */
+static int get_dir_tree(struct commit *commit, const char *dir,
+			struct object_id *oid)
+{
+	unsigned short mode;
+
+	if (repo_parse_commit(the_repository, commit))
+		return -1;
+	if (!*dir) {
+		oidcpy(oid, get_commit_tree_oid(commit));
+		return 0;
+	}
+	if (get_tree_entry(the_repository, get_commit_tree_oid(commit), dir,
+			   oid, &mode) || !S_ISDIR(mode))
+		return -1;
+	return 0;
+}
+
+static void count_changed_entry(struct diff_queue_struct *q,
+				struct diff_options *options, void *data)
+{
+	struct strintmap *changes = data;
+	int i;
+
+	for (i = 0; i < q->nr; i++)
+		strintmap_incr(changes, q->queue[i]->two->path, 1);
+}
+
+/* Count the entries of the tree `new_oid` which differ in `old_oid`. */
+static void count_changed_entries(const struct object_id *old_oid,
+				  const struct object_id *new_oid,
+				  struct strintmap *changes)
+{
+	struct diff_options opt;
+
+	repo_diff_setup(the_repository, &opt);
+	opt.output_format = DIFF_FORMAT_CALLBACK;
+	opt.format_callback = count_changed_entry;
+	opt.format_callback_data = changes;
+	diff_setup_done(&opt);
+	diff_tree_oid(old_oid, new_oid, "", &opt);
+	diff_flush(&opt);
+}
+
+static void queue_commit(struct prio_queue *queue, struct oidset *seen,
+			 struct commit *commit)
+{
+	if (oidset_insert(seen, &commit->object.oid) ||
+	    repo_parse_commit(the_repository, commit))
+		return;
+	prio_queue_put(queue, commit);
+}
+
+/*
+ * Find the last commit changing each entry of the directory `dir` with a
+ * single walk from `tip`, newest commits first. Like "git log", the walk
+ * only follows a parent with the same directory if there is one, and
+ * merges only change the entries which differ from all of their parents.
+ * Commits with a single parent are skipped without reading any tree if
+ * the changed-path Bloom filters say they leave `dir` alone.
+ */
+static void walk_last_commits(struct commit *tip, const char *dir,
+			      struct strmap *names, size_t left)
+{
+	struct prio_queue queue = { compare_commits_by_commit_date };
+	struct oidset seen = OIDSET_INIT;
+	struct strintmap changes;
+	struct hashmap_iter iter;
+	struct strmap_entry *e;
+	struct commit_list *p;
+	struct commit *commit, *same;
+	struct object_id tree, parent_tree;
+	struct ls_entry *entry;
+	int parents;
+
+	strintmap_init(&changes, 0);
+	queue_commit(&queue, &seen, tip);
+	while (left && (commit = prio_queue_get(&queue))) {
+		parents = commit_list_count(commit->parents);
+		if (parents == 1 &&
+		    !cgit_commit_may_change_path(commit, dir)) {
+			queue_commit(&queue, &seen, commit->parents->item);
+			continue;
+		}
+		/* Without the directory, there are no entries to look at. */
+		if (get_dir_tree(commit, dir, &tree))
+			continue;
+
+		same = NULL;
+		for (p = commit->parents; p && !same; p = p->next) {
+			if (!get_dir_tree(p->item, dir, &parent_tree) &&
+			    oideq(&tree, &parent_tree))
+				same = p->item;
+		}
+		if (same) {
+			queue_commit(&queue, &seen, same);
+			continue;
+		}
+
+		strintmap_partial_clear(&changes);
+		if (!parents)
+			count_changed_entries(NULL, &tree, &changes);
+		for (p = commit->parents; p; p = p->next) {
+			if (get_dir_tree(p->item, dir, &parent_tree))
+				count_changed_entries(NULL, &tree, &changes);
+			else
+				count_changed_entries(&parent_tree, &tree,
+						      &changes);
+		}
+		strintmap_for_each_entry(&changes, &iter, e) {
+			if ((intptr_t)e->value < (parents ? parents : 1))
+				continue;
+			entry = strmap_get(names, e->key);
+			if (entry && !entry->last_commit) {
+				entry->last_commit = commit;
+				left--;
+			}
+		}
+		for (p = commit->parents; p; p = p->next)
+			queue_commit(&queue, &seen, p->item);
+	}
+	strintmap_clear(&changes);
+	oidset_clear(&seen);
+	clear_prio_queue(&queue);
+}
+
+static void find_last_commits(struct ls_entries *entries, struct commit *tip,
+			      const char *dir)
+{
+	struct strmap names = STRMAP_INIT;
+	size_t i;
+
+	for (i = 0; i < entries->nr; i++)
+		strmap_put(&names, entries->items[i].name, &entries->items[i]);
+	if (load_last_commits(tip, dir, &names)) {
+		if (*dir)
+			cgit_update_bloom_filters(oid_to_hex(&tip->object.oid));
+		walk_last_commits(tip, dir, &names, entries->nr);
+		store_last_commits(tip, dir, entries);
+	}
+	strmap_clear(&names, 0);
+}
+
+static int ls_entries(void *cbdata)
+{
+	struct walk_tree_context *walk_tree_ctx = cbdata;
+	struct ls_entries entries = { 0 };
+	struct pathspec paths = {
+		.nr = 0
+	};
+	struct commitinfo_slab infos;
+	struct commitinfo **info;
+	struct tree *tree;
+	size_t i;
+
+	tree = lookup_tree(the_repository, &walk_tree_ctx->tree_oid);
+	if (!tree)
+		return 1;
+	read_tree(the_repository, tree, &paths, collect_entry, &entries);
+	if (ctx.repo->enable_tree_sizes)
+		read_entry_sizes(&entries);
+	if (ctx.repo->enable_tree_last_commit)
+		find_last_commits(&entries, walk_tree_ctx->commit,
+				  ctx.qry.path ? ctx.qry.path : "");
+	init_commitinfo_slab(&infos);
+	for (i = 0; i < entries.nr; i++)
+		ls_item(&entries.items[i], walk_tree_ctx, &infos);
+	for (i = 0; i < entries.nr; i++) {
+		if (entries.items[i].last_commit) {
+			info = commitinfo_slab_peek(&infos,
+						    entries.items[i].last_commit);
+			if (info && *info) {
+				cgit_free_commitinfo(*info);
+				*info = NULL;
+			}
+		}
+		free(entries.items[i].name);
+	}
+	clear_commitinfo_slab(&infos);
+	free(entries.items);
 	return 0;
 }
 
+/* The links of the listing are made from the commit id, so it only
+ * depends on the tree, the commit and the options used for the links.
+ * The stats links need the branch, as the stats page has no revision.
+ */
+static void print_ls_entries(struct walk_tree_context *walk_tree_ctx)
+{
+	struct strbuf last_commit = STRBUF_INIT;
+	char *key;
+
+	if (ctx.repo->enable_tree_last_commit)
+		strbuf_addf(&last_commit, "%d %d %d %d",
+			    ctx.qry.difftype, ctx.qry.context,
+			    ctx.qry.ignorews, ctx.qry.follow);
+	else
+		strbuf_addch(&last_commit, '-');
+	key = xstrfmt("tree %s %s %d %d %s %d %d %s %s",
+		      oid_to_hex(&walk_tree_ctx->tree_oid),
+		      oid_to_hex(&walk_tree_ctx->commit->object.oid),
+		      ctx.qry.showmsg, ctx.repo->max_stats,
+		      ctx.repo->max_stats ? ctx.qry.head : "-",
+		      ctx.repo->enable_blame, ctx.repo->enable_tree_sizes,
+		      last_commit.buf, ctx.qry.path ? ctx.qry.path : "");
+
+	cgit_print_fragment(key, ls_entries, walk_tree_ctx);
+	strbuf_release(&last_commit);
+	free(key);
+}
+
 static void ls_head(void)
 {
 	cgit_print_layout_start();
@@ -288,7 +715,12 @@ static void ls_head(void)
 	html("<tr class='nohover'>");
 	html("<th class='left'>Mode</th>");
 	html("<th class='left'>Name</th>");
-	html("<th class='right'>Size</th>");
+	if (ctx.repo->enable_tree_sizes)
+		html("<th class='right'>Size</th>");
+	if (ctx.repo->enable_tree_last_commit) {
+		html("<th class='left'>Last commit</th>");
+		html("<th class='left'>Date</th>");
+	}
 	html("<th/>");
 	html("</tr>\n");
 }
@@ -302,9 +734,6 @@ static void ls_tail(void)
 static void ls_tree(const struct object_id *oid, const char *path, struct walk_tree_context *walk_tree_ctx)
 {
 	struct tree *tree;
-	struct pathspec paths = {
-		.nr = 0
-	};
 
 	tree = parse_tree_indirect(oid);
 	if (!tree) {
@@ -313,8 +742,9 @@ static void ls_tree(const struct object_id *oid, const char *path, struct walk_t
 		return;
 	}
 
+	oidcpy(&walk_tree_ctx->tree_oid, &tree->object.oid);
 	ls_head();
-	read_tree(the_repository, tree, &paths, ls_item, walk_tree_ctx);
+	print_ls_entries(walk_tree_ctx);
 	ls_tail();
 }
 
@@ -334,10 +764,10 @@ static int walk_tree(const struct object_id *oid, struct strbuf *base,
 
 		if (S_ISDIR(mode)) {
 			walk_tree_ctx->state = 1;
+			oidcpy(&walk_tree_ctx->tree_oid, oid);
 			cgit_set_title_from_path(buffer.buf);
 			strbuf_release(&buffer);
-			ls_head();
-			return READ_TREE_RECURSIVE;
+			return 0;
 		} else {
 			walk_tree_ctx->state = 2;
 			print_object(oid, buffer.buf, pathname, walk_tree_ctx->curr_rev);
@@ -345,7 +775,6 @@ static int walk_tree(const struct object_id *oid, struct strbuf *base,
 			return 0;
 		}
 	}
-	ls_item(oid, base, pathname, mode, walk_tree_ctx);
 	return 0;
 }
 
@@ -387,6 +816,7 @@ void cgit_print_tree(const char *rev, char *path)
 	}
 
 	walk_tree_ctx.curr_rev = xstrdup(rev);
+	walk_tree_ctx.commit = commit;
 
 	if (path == NULL) {
 		ls_tree(get_commit_tree_oid(commit), NULL, &walk_tree_ctx);
@@ -395,8 +825,11 @@ void cgit_print_tree(const char *rev, char *path)
 
 	read_tree(the_repository, repo_get_commit_tree(the_repository, commit),
 		  &paths, walk_tree, &walk_tree_ctx);
-	if (walk_tree_ctx.state == 1)
+	if (walk_tree_ctx.state == 1) {
+		ls_head();
+		print_ls_entries(&walk_tree_ctx);
 		ls_tail();
+	}
 	else if (walk_tree_ctx.state == 2)
 		cgit_print_layout_end();
 	else